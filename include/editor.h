@@ -7,32 +7,102 @@
 void initEditor(void);
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen(void);
+int editorPoll(void);
 
 /* Syntax highlighting functions */
 int is_separator(int c);
-int editorRowHasOpenComment(erow *row);
 void editorUpdateSyntax(erow *row);
+void editorSyntaxFree(erow *row);
 int editorSyntaxToColor(int hl);
 void editorSelectSyntaxHighlight(char *filename);
+int editorSyntaxOpenComment(char *render, long long len, int ic);
+
+/* Highlight thread */
+int editorHighlightPoll(void);
+void editorHighlightWait(void);
+void editorHighlightCancel(void);
+struct hlJob *editorHighlightAbandon(void);
+void editorHighlightJoin(struct hlJob *job);
 
 /* Editor row operations */
 void editorUpdateRow(erow *row);
 void editorInsertRow(int at, char *s, size_t len);
+void editorInsertRows(int at, struct iovec *lines, int n);
+void editorInsertMappedRows(int at, struct iovec *lines, int n);
+void editorAppendMappedLines(size_t off, int n, size_t bytes);
+void editorRowRender(erow *row);
+void editorRowMaterialize(erow *row, int at);
+void editorRowStale(erow *row, int at);
+void editorRowFresh(erow *row);
+int editorRowsSettle(int at, long long budget);
+void editorRowDetach(erow *row);
+char *editorRowChars(erow *row);
+int editorRowSpans(erow *row, struct iovec *span);
+int editorRowCharAt(erow *row, long long at);
+long long editorRowCharToCol(erow *row, long long at);
 void editorFreeRow(erow *row);
+void editorMarkRowDirty(int at);
 void editorDelRow(int at);
-char *editorRowsToString(int *buflen);
-void editorRowInsertChar(erow *row, int at, int c);
+char *editorRowsToString(size_t *buflen);
+void editorRowInsertChar(erow *row, long long at, int c);
 void editorRowAppendString(erow *row, char *s, size_t len);
-void editorRowDelChar(erow *row, int at);
+void editorRowTruncate(erow *row, long long at);
+void editorRowDelChar(erow *row, long long at);
+
+/* Row tree */
+erow *editorRowAt(int at);
+int editorRowIndex(erow *row);
+erow *editorRowNext(erow *row);
+erow *editorRowPrev(erow *row);
+erow *editorRowTreeInsert(int at, struct iovec *lines, int n);
+void editorRowTreeResize(erow *row, long long delta);
+size_t editorRowOffset(int at);
+void editorRowTreeDelete(int at);
+void editorRowTreeFree(void);
+int editorRowTreeWalk(struct rowNode *root, int from,
+                      int (*visit)(erow *row, struct iovec *lines,
+                                   void *arg),
+                      void *arg);
+void editorRowTreeAppendMapped(size_t off, int n, size_t bytes);
+void editorRowsEvict(void);
+void editorRowTreeThawed(void);
+
+/* Add buffer of the piece table */
+char *editorAddAlloc(size_t len);
+char *editorAddAllocAligned(size_t len);
+int editorAddResize(char *p, size_t oldlen, size_t newlen);
+void editorAddFreeAll(void);
+
+/* Row buffer slabs */
+void *editorSlabAlloc(size_t size);
+void editorSlabFree(void *p, size_t size);
+void editorSlabFreeAll(void);
 
 /* Editor character and line operations */
 void editorInsertChar(int c);
 void editorInsertNewline(void);
 void editorDelChar(void);
 
+/* Line indexing */
+void editorIndexLines(lineindex *li, const char *buf, size_t len, size_t base);
+void editorIndexLinesParallel(lineindex *li, const char *buf, size_t len,
+                              size_t base);
+void editorLineIndexAppend(lineindex *li, const size_t *off, size_t count);
+void editorFreeLineIndex(lineindex *li);
+
 /* File operations */
 int editorOpen(char *filename);
+void editorCloseFile(void);
+int editorLoadPoll(void);
+int editorLoadProgress(void);
+int editorLoadPending(void);
+void editorFollowStart(int fd);
+int editorFollowPoll(void);
+int editorFollowProgress(void);
 int editorSave(void);
+int editorSavePoll(void);
+void editorSaveWait(void);
+int editorSaveProgress(void);
 int editorFileWasModified(void);
 
 /* Search functionality */
@@ -5,12 +5,15 @@
 
 #ifdef __linux__
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE /* madvise() */
 #endif
 
 #include <termios.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
+#include <stddef.h>
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
@@ -22,6 +25,12 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 /* Syntax highlight types */
 #define HL_NORMAL 0
@@ -34,11 +43,45 @@
 #define HL_NUMBER 7
 #define HL_MATCH 8 /* Search match. */
 
+/* Row validity flags, see editorRowMaterialize(). */
+#define ROW_RENDER (1 << 0) /* 'render' is up to date with the content. */
+#define ROW_HL (1 << 1)     /* 'hl' and 'hl_oc' match 'render'... */
+#define ROW_HL_IC (1 << 2)  /* ...for a row starting inside a comment. */
+#define ROW_ALIAS (1 << 3)  /* 'render' points to 'chars', it had no tabs. */
+#define ROW_WINDOW (1 << 4) /* Only a window of a long row is rendered. */
+#define ROW_STALE (1 << 5)  /* 'hl_oc' may be out of date, see E.hlstale. */
+#define ROW_MAPPED (1 << 6) /* 'chars' points into the read-only mapping. */
+#define ROW_GAP (1 << 7)    /* 'chars' has a gap, see editorRowReserve(). */
+#define ROW_FROZEN (1 << 8) /* 'chars' may be read by a background job. */
+
 #define HL_HIGHLIGHT_STRINGS (1 << 0)
 #define HL_HIGHLIGHT_NUMBERS (1 << 1)
 
 #define KILO_QUIT_TIMES 3
 #define KILO_QUERY_LEN 256
+#define KILO_INDEX_CHUNK (8 * 1024 * 1024) /* Min bytes per indexing thread. */
+#define KILO_INDEX_MAX_THREADS 64
+#define KILO_LOAD_FIRST (1024 * 1024) /* Indexed before the first frame. */
+#define KILO_LOAD_TIME 10 /* Max milliseconds per editorLoadPoll(). */
+#define KILO_FOLLOW_READ 65536 /* Read size of appended data with -f... */
+#define KILO_FOLLOW_BATCH (4 * 1024 * 1024) /* ...and max bytes per poll. */
+#define KILO_TREE_LEAF 64   /* Rows per leaf of the row tree, 64 at most. */
+#define KILO_TREE_FANOUT 64 /* Children per node of the row tree. */
+#define KILO_ROW_GAP 16 /* Min gap when a row grows, see editorRowReserve. */
+#define KILO_ROW_LONG (256 * 1024) /* Longer rows are rendered by windows... */
+#define KILO_ROW_WINDOW 4096 /* ...of this many columns plus the screen. */
+#define KILO_ROW_CHUNK (64 * 1024) /* Bytes per entry of the column index. */
+#define KILO_SLAB_SIZE (64 * 1024) /* Allocation unit of the row slabs. */
+#define KILO_SLAB_MAX 4096 /* Bigger row buffers are malloc()ed one by one. */
+#define KILO_ADD_BLOCK (1024 * 1024) /* Allocation unit of the add buffer. */
+#define KILO_INSERT_BATCH 1024 /* Rows the loaders insert at once. */
+#define KILO_SETTLE_SYNC (1024 * 1024) /* Bytes settled before drawing plain. */
+#define KILO_HL_BATCH (1024 * 1024) /* Rows per highlight thread job. */
+#define KILO_SAVE_IOV 1024 /* Buffers per writev(2) call when saving. */
+/* Unmodified leading bytes needed to save by rewriting just the tail... */
+#define KILO_SAVE_INCREMENTAL_MIN (1024 * 1024)
+/* ...and max bytes of that tail. */
+#define KILO_SAVE_INCREMENTAL_MAX (1024 * 1024)
 
 /* Key action enumeration */
 enum KEY_ACTION
@@ -80,19 +123,117 @@ struct editorSyntax
     int flags;
 };
 
-/* This structure represents a single line of the file we are editing. */
+/* A run of rendered characters sharing the same syntax highlight type. Most
+ * of a row is usually HL_NORMAL, which is what is left between the runs, so
+ * a run is stored as the count of HL_NORMAL characters before it, its
+ * length and its type, all in 32 bits, and the highlight takes a fraction
+ * of the size of the text. Longer gaps and runs are split, see
+ * editorSyntaxStore(). */
+typedef struct hlspan
+{
+    unsigned int skip : 12; /* HL_NORMAL characters before the run. */
+    unsigned int len : 16;
+    unsigned int hl : 4;    /* HL_* type. */
+} hlspan;
+
+/* This structure represents a single line of the file we are editing.
+ * There is one per line of the file, so it is kept to 56 bytes: what only
+ * some rows need is stored with them, the gap of the edited rows before
+ * their content (see editorRowReserve()), and the window of long rows in
+ * their column index. */
 typedef struct erow
 {
-    int idx;           /* Row index in the file, zero-based. */
-    int size;          /* Size of the row, excluding the null term. */
-    int rsize;         /* Size of the rendered row. */
-    char *chars;       /* Row content. */
-    char *render;      /* Row content "rendered" for screen (for TABs). */
-    unsigned char *hl; /* Syntax highlight type for each character in render.*/
-    int hl_oc;         /* Row had open comment at end in last syntax highlight
-                          check. */
+    struct rowLeaf *leaf; /* Leaf of the row tree holding this row. */
+    char *chars;       /* Row content: a piece of E.map (ROW_MAPPED, not null
+                          terminated) or of the add buffer. With ROW_GAP the
+                          content is split by a gap of unused bytes, see
+                          editorRowChars(). */
+    char *render;      /* Row content "rendered" for screen (for TABs), not
+                          null terminated. It points into 'chars' when there
+                          is no TAB to expand, see editorUpdateRow(). */
+    hlspan *hl;        /* Syntax highlight of the render, as runs of
+                          characters of the same type other than HL_NORMAL,
+                          in order. */
+    struct rowCols *cols; /* Column index of long rows, or NULL. */
+    long long size;    /* Size of the row, excluding the null term. */
+    int rsize;         /* Size of the rendered row: rows longer than
+                          KILO_ROW_LONG only render a window. */
+    unsigned int nhl : 21;   /* Number of runs in 'hl'. */
+    unsigned int hl_oc : 1;  /* Row had open comment at end in last syntax
+                                highlight check. */
+    unsigned int flags : 10; /* ROW_* flags. */
 } erow;
 
+/* Render column of every KILO_ROW_CHUNK bytes of the content of a long row,
+ * so that the content at a given column can be found without expanding the
+ * tabs of the whole row, see editorRowColToChar(), and state of the
+ * highlighter there, so that a window can be highlighted without scanning
+ * all the content before it, see editorSyntaxWindowState(). */
+struct rowChunk
+{
+    long long col;      /* Render column where the chunk starts. */
+    unsigned int state; /* State of the highlighter where it starts. */
+};
+
+struct rowCols
+{
+    long long cap;     /* Entries 'chunk' has room for. */
+    long long valid;   /* Entries whose 'col' is up to date, at least one. */
+    long long hlvalid; /* Entries whose 'state' is up to date... */
+    int hlkey;         /* ...for this syntax and state at the row start. */
+    long long rcol;    /* Column of the first rendered character. */
+    long long wstart;  /* Content offset where the rendered window starts... */
+    long long wend;    /* ...and where it ends. */
+    signed char oc[2]; /* Open comment state at the end of the row when it
+                          starts outside or inside a comment, -1 until it is
+                          known, see editorSyntaxRowOpenComment(). */
+    struct rowChunk chunk[];
+};
+
+/* The rows are kept in a B+tree ordered by position in the file, where every
+ * node stores how many rows each of its children holds, so that finding,
+ * inserting and deleting the row at a given index is O(log n), and how many
+ * bytes, so that the file offset of a row is found as fast. See
+ * row_tree.c. Rows are stored directly in the leaves, which are also linked
+ * together to walk the rows in order. Pointers to rows are only valid until
+ * rows are inserted or deleted, or a save starts: the save keeps the tree as
+ * it was, and the leaves and nodes it reads are copied before they change,
+ * see editorTreeThawLeaf(). Nor across editorRowsEvict(): in memory budget
+ * mode the rows of a leaf are dropped when they are just lines of the file
+ * mapping, and made again from it when needed, see editorTreeLoad(). */
+struct rowLeaf
+{
+    struct rowNode *parent;
+    struct rowLeaf *prev, *next;
+    int gen;                      /* E.freezegen + 1 when created. */
+    int n;                        /* Rows used in 'rows'. */
+    long long bytes;              /* Bytes of the rows, newlines included. */
+    erow *rows;                   /* KILO_TREE_LEAF rows, NULL if unloaded. */
+    size_t mapoff;                /* Unloaded: offset of the lines in E.map, */
+    uint64_t oc, stale;           /* and the hl_oc and ROW_STALE bits. */
+    size_t mapmem;                /* Mapped bytes counted in E.rowmem. */
+    int used;                     /* Used since the eviction sweep passed. */
+};
+
+struct rowNode
+{
+    struct rowNode *parent;       /* NULL for the root. */
+    int gen;                      /* E.freezegen + 1 when created. */
+    int leaves;                   /* Children are leaves, not nodes. */
+    int n;                        /* Children used. */
+    int count[KILO_TREE_FANOUT];  /* Rows under every child... */
+    long long bytes[KILO_TREE_FANOUT]; /* ...and their bytes. */
+    void *child[KILO_TREE_FANOUT];
+};
+
+/* Positions of the newlines found in a buffer, see editorIndexLines(). */
+typedef struct lineindex
+{
+    size_t *off;  /* Offset of every '\n', in ascending order. */
+    size_t count; /* Number of offsets stored. */
+    size_t cap;   /* Number of offsets 'off' has room for. */
+} lineindex;
+
 /* Color structure for syntax highlighting */
 typedef struct hlcolor
 {
@@ -104,17 +245,39 @@ struct editorConfig
 {
     int cx, cy;     /* Cursor x and y position in characters */
     int rowoff;     /* Offset of row displayed. */
-    int coloff;     /* Offset of column displayed. */
+    long long coloff; /* Offset of column displayed. */
     int screenrows; /* Number of rows that we can show */
     int screencols; /* Number of cols that we can show */
     int numrows;    /* Number of rows */
     int rawmode;    /* Is terminal raw mode enabled? */
-    erow *row;      /* Rows */
+    struct rowNode *rows; /* Root of the row tree, NULL if no rows. */
     int dirty;      /* File modified but not saved. */
+    int dirtyrow;   /* First row modified since load or save, -1 if none. */
+    int saving;     /* A background save is running. */
+    int savegen;    /* E.freezegen of the running save. */
+    int hlgen;      /* E.freezegen of the running highlight job, or 0. */
+    int freezegen;  /* Incremented every time a background job starts. */
     char *filename; /* Currently open filename */
+    char *map;      /* Read-only mapping of the open file, or NULL. */
+    size_t maplen;  /* Length of the mapping. */
+    dev_t mapdev;   /* Device and inode of the mapped file. */
+    ino_t mapino;
+    struct stat filest; /* File as last loaded or saved, st_ino 0 if unknown. */
     char statusmsg[80];
     time_t statusmsg_time;
     struct editorSyntax *syntax; /* Current syntax highlight, or NULL. */
+    int follow;       /* Follow the file as it grows (-f). */
+    size_t membudget; /* Max bytes of rows kept in memory, 0 for no limit. */
+    size_t rowmem;    /* Bytes of rows in memory: the rows of the loaded
+                         leaves, the mapped lines they were loaded from,
+                         their render and highlight. */
+    int lruhand;      /* Next row the eviction sweep looks at. */
+    int hlvalid;      /* Rows before this one have an up to date hl_oc. */
+    int hlstale;      /* Rows flagged ROW_STALE. */
+    int hlfence;      /* First row changed since the highlight job started. */
+    int findrow;      /* Row of the search match shown as HL_MATCH, or -1. */
+    long long findcol; /* Column and length of the match. */
+    int findlen;
 };
 
 /* Global editor state */
@@ -9,10 +9,23 @@ void initEditor(void)
     E.rowoff = 0;
     E.coloff = 0;
     E.numrows = 0;
-    E.row = NULL;
+    E.rows = NULL;
     E.dirty = 0;
+    E.dirtyrow = -1;
+    E.saving = 0;
+    E.savegen = 0;
+    E.hlgen = 0;
+    E.freezegen = 0;
     E.filename = NULL;
     E.syntax = NULL;
+    E.follow = 0;
+    E.membudget = 0;
+    E.rowmem = 0;
+    E.lruhand = 0;
+    E.hlvalid = 0;
+    E.hlstale = 0;
+    E.hlfence = INT_MAX;
+    E.findrow = -1;
     updateWindowSize();
     signal(SIGWINCH, handleSigWinCh);
 }
@@ -32,11 +45,14 @@ void editorSetStatusMessage(const char *fmt, ...)
  * starting from the logical state of the editor in the global state 'E'. */
 void editorRefreshScreen(void)
 {
-    int y;
+    int y, plain = 0;
     erow *r;
     char buf[32];
     struct abuf ab = ABUF_INIT;
 
+    /* No row is in use between frames: the rows not used recently can go,
+     * and the ones drawn now stay until the next frame at least. */
+    editorRowsEvict();
     abAppend(&ab, "\x1b[?25l", 6); /* Hide cursor. */
     abAppend(&ab, "\x1b[H", 3);    /* Go home. */
     for (y = 0; y < E.screenrows; y++)
@@ -67,20 +83,49 @@ void editorRefreshScreen(void)
             continue;
         }
 
-        r = &E.row[filerow];
+        /* When the open comment state of the rows before the screen is
+         * not known yet, and finding it out would take long, the rows are
+         * drawn plain until the highlight thread catches up. */
+        r = editorRowAt(filerow);
+        if (!plain && !editorRowsSettle(filerow, KILO_SETTLE_SYNC))
+            plain = 1;
+        if (plain)
+            editorRowRender(r);
+        else
+            editorRowMaterialize(r, filerow);
 
-        int len = r->rsize - E.coloff;
+        /* Long rows are rendered from column rcol on, see
+         * editorUpdateRow(). */
+        long long rcol = r->flags & ROW_WINDOW ? r->cols->rcol : 0;
+        long long len = rcol + r->rsize - E.coloff;
         int current_color = -1;
         if (len > 0)
         {
             if (len > E.screencols)
                 len = E.screencols;
-            char *c = r->render + E.coloff;
-            unsigned char *hl = r->hl + E.coloff;
+            long long off = E.coloff - rcol;
+            char *c = r->render + off;
+            hlspan *span = r->hl, *spanend = plain ? span : r->hl + r->nhl;
+            long long start = span < spanend ? span->skip : 0; /* Of 'span'. */
             int j;
             for (j = 0; j < len; j++)
             {
-                if (hl[j] == HL_NONPRINT)
+                /* Find the highlight run of the character, if any, and
+                 * put the search match over it. */
+                int hl = HL_NORMAL;
+                while (span < spanend && start + span->len <= off + j)
+                {
+                    start += span->len;
+                    if (++span < spanend)
+                        start += span->skip;
+                }
+                if (span < spanend && start <= off + j)
+                    hl = span->hl;
+                if (filerow == E.findrow && E.coloff + j >= E.findcol &&
+                    E.coloff + j < E.findcol + E.findlen)
+                    hl = HL_MATCH;
+
+                if (hl == HL_NONPRINT)
                 {
                     char sym;
                     abAppend(&ab, "\x1b[7m", 4);
@@ -91,7 +136,7 @@ void editorRefreshScreen(void)
                     abAppend(&ab, &sym, 1);
                     abAppend(&ab, "\x1b[0m", 4);
                 }
-                else if (hl[j] == HL_NORMAL)
+                else if (hl == HL_NORMAL)
                 {
                     if (current_color != -1)
                     {
@@ -102,7 +147,7 @@ void editorRefreshScreen(void)
                 }
                 else
                 {
-                    int color = editorSyntaxToColor(hl[j]);
+                    int color = editorSyntaxToColor(hl);
                     if (color != current_color)
                     {
                         char buf[16];
@@ -122,9 +167,17 @@ void editorRefreshScreen(void)
     /* Create a two rows status. First row: */
     abAppend(&ab, "\x1b[0K", 4);
     abAppend(&ab, "\x1b[7m", 4);
-    char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                       E.filename, E.numrows, E.dirty ? "(modified)" : "");
+    char status[80], rstatus[80], progress[20] = "";
+    int loaded = editorLoadProgress(), saved = editorSaveProgress();
+    if (loaded == -1)
+        loaded = editorFollowProgress();
+    if (loaded != -1)
+        snprintf(progress, sizeof(progress), " (loading %d%%)", loaded);
+    else if (saved != -1)
+        snprintf(progress, sizeof(progress), " (saving %d%%)", saved);
+    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s%s",
+                       E.filename, E.numrows, E.dirty ? "(modified)" : "",
+                       progress);
     int rlen = snprintf(rstatus, sizeof(rstatus),
                         "%d/%d", E.rowoff + E.cy + 1, E.numrows);
     if (len > E.screencols)
@@ -154,15 +207,15 @@ void editorRefreshScreen(void)
     /* Put cursor at its current position. Note that the horizontal position
      * at which the cursor is displayed may be different compared to 'E.cx'
      * because of TABs. */
-    int j;
+    long long j;
     int cx = 1;
     int filerow = E.rowoff + E.cy;
-    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+    erow *row = editorRowAt(filerow);
     if (row)
     {
         for (j = E.coloff; j < (E.cx + E.coloff); j++)
         {
-            if (j < row->size && row->chars[j] == TAB)
+            if (j < row->size && editorRowCharAt(row, j) == TAB)
                 cx += 7 - ((cx) % 8);
             cx++;
         }
@@ -174,6 +227,19 @@ void editorRefreshScreen(void)
     abFree(&ab);
 }
 
+/* Called by editorReadKey() every time reading the terminal times out (see
+ * enableRawMode()), and by the main loop after every key, in order to
+ * handle the work that completes in the background. Returns true if the
+ * screen should be redrawn. */
+int editorPoll(void)
+{
+    int redraw = editorLoadPoll();
+    redraw |= editorSavePoll();
+    redraw |= editorFollowPoll();
+    redraw |= editorHighlightPoll();
+    return redraw;
+}
+
 int editorFileWasModified(void)
 {
     return E.dirty;
@@ -6,8 +6,8 @@
 void editorInsertChar(int c)
 {
     int filerow = E.rowoff + E.cy;
-    int filecol = E.coloff + E.cx;
-    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+    long long filecol = E.coloff + E.cx;
+    erow *row = editorRowAt(filerow);
 
     /* If the row where the cursor is currently located does not exist in our
      * logical representaion of the file, add enough empty rows as needed. */
@@ -16,7 +16,7 @@ void editorInsertChar(int c)
         while (E.numrows <= filerow)
             editorInsertRow(E.numrows, "", 0);
     }
-    row = &E.row[filerow];
+    row = editorRowAt(filerow);
     editorRowInsertChar(row, filecol, c);
     if (E.cx == E.screencols - 1)
         E.coloff++;
@@ -30,8 +30,8 @@ void editorInsertChar(int c)
 void editorInsertNewline(void)
 {
     int filerow = E.rowoff + E.cy;
-    int filecol = E.coloff + E.cx;
-    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+    long long filecol = E.coloff + E.cx;
+    erow *row = editorRowAt(filerow);
 
     if (!row)
     {
@@ -53,11 +53,10 @@ void editorInsertNewline(void)
     else
     {
         /* We are in the middle of a line. Split it between two rows. */
-        editorInsertRow(filerow + 1, row->chars + filecol, row->size - filecol);
-        row = &E.row[filerow];
-        row->chars[filecol] = '\0';
-        row->size = filecol;
-        editorUpdateRow(row);
+        editorInsertRow(filerow + 1, editorRowChars(row) + filecol,
+                        row->size - filecol);
+        row = editorRowAt(filerow);
+        editorRowTruncate(row, filecol);
     }
 fixcursor:
     if (E.cy == E.screenrows - 1)
@@ -76,8 +75,8 @@ fixcursor:
 void editorDelChar(void)
 {
     int filerow = E.rowoff + E.cy;
-    int filecol = E.coloff + E.cx;
-    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+    long long filecol = E.coloff + E.cx;
+    erow *row = editorRowAt(filerow);
 
     if (!row || (filecol == 0 && filerow == 0))
         return;
@@ -85,20 +84,23 @@ void editorDelChar(void)
     {
         /* Handle the case of column 0, we need to move the current line
          * on the right of the previous one. */
-        filecol = E.row[filerow - 1].size;
-        editorRowAppendString(&E.row[filerow - 1], row->chars, row->size);
+        filecol = editorRowAt(filerow - 1)->size;
+        editorRowAppendString(editorRowAt(filerow - 1), editorRowChars(row),
+                              row->size);
         editorDelRow(filerow);
         row = NULL;
         if (E.cy == 0)
             E.rowoff--;
         else
             E.cy--;
-        E.cx = filecol;
-        if (E.cx >= E.screencols)
+        if (filecol >= E.screencols)
         {
-            int shift = (E.screencols - E.cx) + 1;
-            E.cx -= shift;
-            E.coloff += shift;
+            E.coloff = filecol - E.screencols + 1;
+            E.cx = E.screencols - 1;
+        }
+        else
+        {
+            E.cx = filecol;
         }
     }
     else
@@ -109,8 +111,6 @@ void editorDelChar(void)
         else
             E.cx--;
     }
-    if (row)
-        editorUpdateRow(row);
     E.dirty++;
 }
 
@@ -118,9 +118,9 @@ void editorDelChar(void)
 void editorMoveCursor(int key)
 {
     int filerow = E.rowoff + E.cy;
-    int filecol = E.coloff + E.cx;
-    int rowlen;
-    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+    long long filecol = E.coloff + E.cx;
+    long long rowlen;
+    erow *row = editorRowAt(filerow);
 
     switch (key)
     {
@@ -135,13 +135,17 @@ void editorMoveCursor(int key)
             {
                 if (filerow > 0)
                 {
+                    long long size = editorRowAt(filerow - 1)->size;
                     E.cy--;
-                    E.cx = E.row[filerow - 1].size;
-                    if (E.cx > E.screencols - 1)
+                    if (size > E.screencols - 1)
                     {
-                        E.coloff = E.cx - E.screencols + 1;
+                        E.coloff = size - E.screencols + 1;
                         E.cx = E.screencols - 1;
                     }
+                    else
+                    {
+                        E.cx = size;
+                    }
                 }
             }
         }
@@ -204,17 +208,34 @@ void editorMoveCursor(int key)
     /* Fix cx if the current line has not enough chars. */
     filerow = E.rowoff + E.cy;
     filecol = E.coloff + E.cx;
-    row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+    row = editorRowAt(filerow);
     rowlen = row ? row->size : 0;
     if (filecol > rowlen)
     {
-        E.cx -= filecol - rowlen;
-        if (E.cx < 0)
+        long long cx = E.cx - (filecol - rowlen);
+        if (cx < 0)
         {
-            E.coloff += E.cx;
-            E.cx = 0;
+            E.coloff += cx;
+            cx = 0;
         }
+        E.cx = cx;
+    }
+}
+
+/* While the file is still loading in the background, or when it is followed
+ * as it grows, it can only be browsed. Return true, after telling the user,
+ * if that's the case. */
+static int editorBrowseOnly(void)
+{
+    if (E.follow)
+    {
+        editorSetStatusMessage("Following the file, it can't be modified");
+        return 1;
     }
+    if (editorLoadProgress() == -1)
+        return 0;
+    editorSetStatusMessage("File still loading, it can't be modified yet");
+    return 1;
 }
 
 /* Process events arriving from the standard input, which is, the user
@@ -229,6 +250,8 @@ void editorProcessKeypress(int fd)
     switch (c)
     {
     case ENTER: /* Enter */
+        if (editorBrowseOnly())
+            break;
         editorInsertNewline();
         break;
     case CTRL_C: /* Ctrl-c */
@@ -245,9 +268,12 @@ void editorProcessKeypress(int fd)
             quit_times--;
             return;
         }
+        editorCloseFile();
         exit(0);
         break;
     case CTRL_S: /* Ctrl-s */
+        if (editorBrowseOnly())
+            break;
         editorSave();
         break;
     case CTRL_F:
@@ -256,6 +282,8 @@ void editorProcessKeypress(int fd)
     case BACKSPACE: /* Backspace */
     case CTRL_H:    /* Ctrl-h */
     case DEL_KEY:
+        if (editorBrowseOnly())
+            break;
         editorDelChar();
         break;
     case PAGE_UP:
@@ -284,6 +312,8 @@ void editorProcessKeypress(int fd)
         /* Nothing to do for ESC in this mode. */
         break;
     default:
+        if (editorBrowseOnly())
+            break;
         editorInsertChar(c);
         break;
     }
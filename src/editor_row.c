@@ -1,81 +1,701 @@
 #include "kilo.h"
 #include "editor.h"
 
-/* Update the rendered version and the syntax highlight of a row. */
-void editorUpdateRow(erow *row)
+/* Memory used by the render of a row. The highlight is accounted for in
+ * syntax.c, the row itself and its mapped line in row_tree.c: the memory
+ * budget mode keeps the sum under control, see editorRowsEvict(). */
+static size_t editorRowMem(erow *row)
 {
-    unsigned int tabs = 0, nonprint = 0;
-    int j, idx;
+    if (row->render == NULL || (row->flags & ROW_ALIAS))
+        return 0;
+    return row->rsize;
+}
 
-    /* Create a version of the row we can directly print on the screen,
-     * respecting tabs, substituting non printable characters with '?'. */
-    free(row->render);
-    for (j = 0; j < row->size; j++)
-        if (row->chars[j] == TAB)
-            tabs++;
+/* Release the render and syntax highlight of a row. */
+static void editorRowFreeRender(erow *row)
+{
+    E.rowmem -= editorRowMem(row);
+    if (row->render && !(row->flags & ROW_ALIAS))
+        editorSlabFree(row->render, row->rsize);
+    editorSyntaxFree(row);
+    row->render = NULL;
+    row->flags &= ~(ROW_RENDER | ROW_HL | ROW_ALIAS | ROW_WINDOW);
+}
+
+/* Release the column index of a long row. */
+static void editorRowFreeCols(erow *row)
+{
+    if (row->cols)
+        editorSlabFree(row->cols,
+                       sizeof(struct rowCols) +
+                           row->cols->cap * sizeof(struct rowChunk));
+    row->cols = NULL;
+}
+
+/* The gap of a row flagged ROW_GAP, see editorRowReserve(). It is stored
+ * in the add buffer right before the content, so that the rows that are
+ * never edited, that is most of them, don't pay for it. */
+struct rowGap
+{
+    long long at;  /* Offset of the gap in 'chars'. */
+    long long len; /* Length of the gap. */
+};
+
+/* Return the gap of a row flagged ROW_GAP. */
+static struct rowGap *editorRowGap(erow *row)
+{
+    return (struct rowGap *)row->chars - 1;
+}
 
-    unsigned long long allocsize =
-        (unsigned long long)row->size + tabs * 8 + nonprint * 9 + 1;
-    if (allocsize > UINT32_MAX)
+/* Return the gap of any row: an empty one at the end without ROW_GAP. */
+static struct rowGap editorRowGapOf(erow *row)
+{
+    if (row->flags & ROW_GAP)
+        return *editorRowGap(row);
+    return (struct rowGap){row->size, 0};
+}
+
+/* Return the content of 'row' from offset 'at', and set '*len' to how many
+ * bytes can be read there, at most '*len' on entry: the gap can't be
+ * crossed. */
+static char *editorRowSpan(erow *row, long long at, long long *len)
+{
+    struct rowGap g = editorRowGapOf(row);
+
+    if (at < g.at)
     {
-        printf("Some line of the edited file is too long for kilo\n");
-        exit(1);
+        if (*len > g.at - at)
+            *len = g.at - at;
+        return row->chars + at;
     }
+    if (*len > row->size - at)
+        *len = row->size - at;
+    return row->chars + at + g.len;
+}
 
-    row->render = malloc(row->size + tabs * 8 + nonprint * 9 + 1);
-    idx = 0;
-    for (j = 0; j < row->size; j++)
+/* Return the render column where the content from offset 'from' to 'to'
+ * ends, if it starts at column 'col': this is where tabs are expanded. */
+static long long editorRowCols(erow *row, long long from, long long to,
+                               long long col)
+{
+    while (from < to)
+    {
+        long long len = to - from;
+        char *p = editorRowSpan(row, from, &len);
+        char *tab = memchr(p, TAB, len);
+        long long plain = tab ? tab - p : len;
+
+        col += plain;
+        from += plain;
+        if (tab)
+        {
+            col++;
+            while ((col + 1) % 8 != 0)
+                col++;
+            from++;
+        }
+    }
+    return col;
+}
+
+/* Return the column index of a long row, with room for the whole row and
+ * at least its first entry up to date. The index is only extended as far
+ * as needed, see editorRowColsExtend(). */
+static struct rowCols *editorRowColsIndex(erow *row)
+{
+    long long need = row->size / KILO_ROW_CHUNK + 1;
+    struct rowCols *c = row->cols;
+
+    if (c == NULL || c->cap < need)
     {
-        if (row->chars[j] == TAB)
+        long long cap = need * 2;
+        c = editorSlabAlloc(sizeof(*c) + cap * sizeof(struct rowChunk));
+        if (row->cols)
         {
-            row->render[idx++] = ' ';
-            while ((idx + 1) % 8 != 0)
-                row->render[idx++] = ' ';
+            long long n = row->cols->valid > row->cols->hlvalid
+                              ? row->cols->valid
+                              : row->cols->hlvalid;
+            memcpy(c, row->cols, sizeof(*c) + n * sizeof(struct rowChunk));
+            editorRowFreeCols(row);
         }
         else
         {
-            row->render[idx++] = row->chars[j];
+            c->valid = 1;
+            c->chunk[0].col = 0;
+            c->hlvalid = 0;
+            c->wstart = c->wend = 0;
+            c->oc[0] = c->oc[1] = -1;
+        }
+        c->cap = cap;
+        row->cols = c;
+    }
+    if (c->valid > need)
+        c->valid = need;
+    if (c->hlvalid > need)
+        c->hlvalid = need;
+    return c;
+}
+
+/* Bring one more entry of the column index of 'row' up to date. */
+static void editorRowColsExtend(erow *row, struct rowCols *c)
+{
+    long long k = c->valid;
+
+    c->chunk[k].col = editorRowCols(row, (k - 1) * KILO_ROW_CHUNK,
+                                    k * KILO_ROW_CHUNK, c->chunk[k - 1].col);
+    c->valid++;
+}
+
+/* Forget the entries of the column index after the content changed at
+ * offset 'at'. */
+static void editorRowColsEdited(erow *row, long long at)
+{
+    if (row->cols == NULL)
+        return;
+    if (row->cols->valid > at / KILO_ROW_CHUNK + 1)
+        row->cols->valid = at / KILO_ROW_CHUNK + 1;
+    if (row->cols->hlvalid > at / KILO_ROW_CHUNK + 1)
+        row->cols->hlvalid = at / KILO_ROW_CHUNK + 1;
+    row->cols->oc[0] = row->cols->oc[1] = -1;
+}
+
+/* Return the render column of the content at offset 'at' of a row. */
+long long editorRowCharToCol(erow *row, long long at)
+{
+    long long from = 0, col = 0;
+
+    if (row->size > KILO_ROW_LONG)
+    {
+        struct rowCols *c = editorRowColsIndex(row);
+        long long k = at / KILO_ROW_CHUNK;
+        while (c->valid <= k)
+            editorRowColsExtend(row, c);
+        col = c->chunk[k].col;
+        from = k * KILO_ROW_CHUNK;
+    }
+    return editorRowCols(row, from, at, col);
+}
+
+/* Return the offset of the content rendered at column 'col' of a long row,
+ * and set '*start' to the column where it starts, before 'col' if that's
+ * in the middle of a tab. Past the end of the row return its size. Only
+ * the index entries up to 'col' are computed, and a single chunk is
+ * scanned byte by byte. */
+static long long editorRowColToChar(erow *row, long long col, long long *start)
+{
+    struct rowCols *c = editorRowColsIndex(row);
+    long long n = row->size / KILO_ROW_CHUNK + 1;
+    long long lo = 0, hi;
+
+    while (c->valid < n && c->chunk[c->valid - 1].col <= col)
+        editorRowColsExtend(row, c);
+    hi = c->valid - 1;
+    while (lo < hi)
+    {
+        long long mid = (lo + hi + 1) / 2;
+        if (c->chunk[mid].col <= col)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    long long at = lo * KILO_ROW_CHUNK, cur = c->chunk[lo].col;
+    for (; at < row->size; at++)
+    {
+        long long next = cur + 1;
+        if (editorRowCharAt(row, at) == TAB)
+            while ((next + 1) % 8 != 0)
+                next++;
+        if (next > col)
+            break;
+        cur = next;
+    }
+    *start = cur;
+    return at;
+}
+
+/* Return true if the rendered window of a long row covers the columns on
+ * screen. */
+static int editorRowWindowCovers(erow *row)
+{
+    long long rcol = row->cols->rcol;
+
+    return E.coloff >= rcol &&
+           (E.coloff + E.screencols <= rcol + row->rsize ||
+            row->cols->wend == row->size);
+}
+
+/* The open comment state of the rows is kept up to date with a worklist:
+ * the rows whose hl_oc may be wrong, because they changed or the row before
+ * them did, are flagged ROW_STALE, and E.hlvalid is before the first one.
+ * Every other row has the hl_oc it gets from the row before it, so going
+ * down the file only the stale rows need to be highlighted, plus the rows
+ * after those whose hl_oc actually changed, and the walk can stop as soon
+ * as no stale row is left, see editorRowsSettle().
+ *
+ * Flag the row at index 'at', or nothing if 'row' is NULL. */
+void editorRowStale(erow *row, int at)
+{
+    if (row == NULL)
+        return;
+    if (!(row->flags & ROW_STALE))
+    {
+        row->flags |= ROW_STALE;
+        E.hlstale++;
+    }
+    if (at < E.hlvalid)
+        E.hlvalid = at;
+}
+
+/* Take 'row' out of the worklist, once its hl_oc is up to date. */
+void editorRowFresh(erow *row)
+{
+    if (row->flags & ROW_STALE)
+    {
+        row->flags &= ~ROW_STALE;
+        E.hlstale--;
+    }
+}
+
+/* Called when the rows from index 'at' on are no longer the ones the
+ * highlight thread captured, or no longer come after the same rows: its
+ * results for them are dropped, see highlight.c. */
+static void editorRowsChanged(int at)
+{
+    if (at < E.hlfence)
+        E.hlfence = at;
+}
+
+/* Called after the content of the row at index 'at' changed from offset
+ * 'off' on: render and highlight are only computed again once needed, see
+ * editorRowMaterialize(), so that an edit costs the same whether the row is
+ * long or on screen. */
+static void editorRowInvalidate(erow *row, int at, long long off)
+{
+    row->flags &= ~(ROW_RENDER | ROW_HL);
+    editorRowColsEdited(row, off);
+    editorRowStale(row, at);
+    editorRowsChanged(at);
+}
+
+/* Update the rendered version of a row, dropping its syntax highlight. Rows
+ * longer than KILO_ROW_LONG are only rendered in a window around the
+ * columns on screen, found with the column index: the cost doesn't depend
+ * on the length of the row. */
+static void editorRenderRow(erow *row)
+{
+    long long from = 0, limit = LLONG_MAX, rcol = 0, col, j, idx;
+    int s, tabs = 0;
+
+    editorRowFreeRender(row);
+    if (row->size > KILO_ROW_LONG)
+    {
+        long long want = E.coloff - KILO_ROW_WINDOW / 4;
+        from = editorRowColToChar(row, want > 0 ? want : 0, &rcol);
+        limit = E.coloff + E.screencols + KILO_ROW_WINDOW / 2;
+        row->cols->rcol = rcol;
+        row->cols->wstart = from;
+        row->flags |= ROW_WINDOW;
+    }
+    else
+    {
+        editorRowFreeCols(row);
+    }
+
+    /* The content is made of the two spans before and after the gap. */
+    struct rowGap g = editorRowGapOf(row);
+    long long after = from > g.at ? from : g.at;
+    char *span[2] = {row->chars + from, row->chars + g.len + after};
+    long long spanlen[2] = {from < g.at ? g.at - from : 0,
+                            row->size - after};
+
+    /* Create a version of the row we can directly print on the screen,
+     * respecting tabs. Its exact size is computed first, and where the
+     * window ends for long rows. The buffers come from a slab allocator and
+     * are freed by size. */
+    col = rcol;
+    for (s = 0; s < 2; s++)
+    {
+        for (j = 0; j < spanlen[s] && col < limit; j++)
+        {
+            col++;
+            if (span[s][j] == TAB)
+            {
+                tabs++;
+                while ((col + 1) % 8 != 0)
+                    col++;
+            }
+        }
+        spanlen[s] = j;
+    }
+    if (row->flags & ROW_WINDOW)
+        row->cols->wend = from + spanlen[0] + spanlen[1];
+    row->rsize = col - rcol;
+
+    /* Most rows have no tabs: then the render is the content itself, as
+     * long as it is contiguous, and nothing is allocated. Either way the
+     * render is not null terminated, and row->rsize bytes long. */
+    if (tabs == 0 && (g.len == 0 || g.at == row->size))
+    {
+        row->render = row->chars + from;
+        row->flags |= ROW_RENDER | ROW_ALIAS;
+        return;
+    }
+
+    char *render = editorSlabAlloc(row->rsize);
+    idx = 0;
+    col = rcol;
+    for (s = 0; s < 2; s++)
+    {
+        for (j = 0; j < spanlen[s]; j++)
+        {
+            render[idx++] = span[s][j] == TAB ? ' ' : span[s][j];
+            col++;
+            if (span[s][j] == TAB)
+                for (; (col + 1) % 8 != 0; col++)
+                    render[idx++] = ' ';
         }
     }
-    row->rsize = idx;
-    row->render[idx] = '\0';
+    row->render = render;
+    row->flags |= ROW_RENDER;
+    E.rowmem += editorRowMem(row);
+}
 
-    /* Update the syntax highlighting attributes of the row. */
+/* Update the rendered version and the syntax highlight of a row. Like the
+ * render, the highlight of long rows only covers the window on screen. */
+void editorUpdateRow(erow *row)
+{
+    editorRenderRow(row);
     editorUpdateSyntax(row);
 }
 
+/* Make room for 'n' new rows at the specified position, shifting the other
+ * rows on the bottom if required, and return the first one with every field
+ * cleared but its size, that of 'lines'. The others follow it, see
+ * editorRowNext(). */
+static erow *editorInsertRowsSlot(int at, struct iovec *lines, int n)
+{
+    erow *row = editorRowTreeInsert(at, lines, n);
+    E.dirty += n;
+    editorMarkRowDirty(at);
+
+    /* The row after the new ones follows a different row now. */
+    editorRowStale(editorRowAt(at + n), at + n);
+    editorRowsChanged(at);
+    erow *new = row;
+    for (int j = 0; j < n; j++, new = editorRowNext(new))
+        editorRowStale(new, at + j);
+    return row;
+}
+
+/* Insert 'n' rows at the specified position at once, copying their content
+ * from 'lines'. The row tree is updated once for the whole batch, and the
+ * render and syntax highlight are computed later by editorRowMaterialize(),
+ * only if the row is ever displayed or searched. */
+void editorInsertRows(int at, struct iovec *lines, int n)
+{
+    if (at > E.numrows || n <= 0)
+        return;
+    erow *row = editorInsertRowsSlot(at, lines, n);
+    for (int j = 0; j < n; j++, row = editorRowNext(row))
+    {
+        row->chars = editorAddAlloc(lines[j].iov_len + 1);
+        memcpy(row->chars, lines[j].iov_base, lines[j].iov_len);
+        row->chars[row->size] = '\0';
+    }
+}
+
 /* Insert a row at the specified position, shifting the other rows on the bottom
  * if required. */
 void editorInsertRow(int at, char *s, size_t len)
 {
-    if (at > E.numrows)
+    struct iovec line = {s, len};
+    editorInsertRows(at, &line, 1);
+}
+
+/* Insert 'n' rows whose content lives in the file mapping, without copying
+ * it. Like for editorInsertRows() nothing else is computed yet. */
+void editorInsertMappedRows(int at, struct iovec *lines, int n)
+{
+    if (at > E.numrows || n <= 0)
         return;
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    if (at != E.numrows)
-    {
-        memmove(E.row + at + 1, E.row + at, sizeof(E.row[0]) * (E.numrows - at));
-        for (int j = at + 1; j <= E.numrows; j++)
-            E.row[j].idx++;
-    }
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len + 1);
-    E.row[at].hl = NULL;
-    E.row[at].hl_oc = 0;
-    E.row[at].render = NULL;
-    E.row[at].rsize = 0;
-    E.row[at].idx = at;
-    editorUpdateRow(E.row + at);
-    E.numrows++;
-    E.dirty++;
+    erow *row = editorInsertRowsSlot(at, lines, n);
+    for (int j = 0; j < n; j++, row = editorRowNext(row))
+    {
+        row->chars = lines[j].iov_base;
+        row->flags |= ROW_MAPPED;
+    }
+}
+
+/* Append 'n' rows, KILO_TREE_LEAF at most, for the lines of the file
+ * mapping from offset 'off' on, 'bytes' long with their newlines, without
+ * even looking at them: in memory budget mode the rows are only made once
+ * used, see editorRowTreeAppendMapped(). */
+void editorAppendMappedLines(size_t off, int n, size_t bytes)
+{
+    int at = E.numrows;
+
+    editorRowTreeAppendMapped(off, n, bytes);
+    E.hlstale += n;
+    if (at < E.hlvalid)
+        E.hlvalid = at;
+    editorRowsChanged(at);
 }
 
-/* Free row's heap allocated stuff. */
+/* Return true if the highlight of 'row' is up to date. Besides its own
+ * content, it depends on the row before it ending inside a comment or not. */
+static int editorRowHlValid(erow *row)
+{
+    erow *prev = editorRowPrev(row);
+    int ic = prev && prev->hl_oc;
+
+    return (row->flags & (ROW_RENDER | ROW_HL)) == (ROW_RENDER | ROW_HL) &&
+           ic == !!(row->flags & ROW_HL_IC);
+}
+
+/* Make sure the open comment state of every row before 'at' is up to date,
+ * so that the row at 'at' can be highlighted. The stale rows from E.hlvalid
+ * on are highlighted in order to find out, and the ones that were not
+ * materialized are released again right away: jumping far away in a file
+ * never seen before costs a single pass over the rows in between, and no
+ * memory. A change only goes down to the rows whose hl_oc changes as well,
+ * so typing in a file costs as many rows as the comments it opens or
+ * closes. Without multi line comments there is nothing to find out.
+ *
+ * The pass stops once about 'budget' bytes of rows were gone through,
+ * leaving E.hlvalid where it got: returns false if the rows before 'at'
+ * are not settled yet. */
+int editorRowsSettle(int at, long long budget)
+{
+    int changed = 0, j;
+
+    if (at <= E.hlvalid)
+        return 1;
+    if (E.syntax == NULL || E.syntax->multiline_comment_start[0] == '\0')
+    {
+        E.hlvalid = at;
+        return 1;
+    }
+    erow *row = E.hlstale ? editorRowAt(E.hlvalid) : NULL;
+    for (j = E.hlvalid; j < at && (changed || E.hlstale);
+         j++, row = editorRowNext(row))
+    {
+        if (budget < 0)
+        {
+            E.hlvalid = j;
+            if (changed)
+                editorRowStale(row, j);
+            return 0;
+        }
+        budget -= 16; /* Going to the next row is not free either. */
+        if (!changed && !(row->flags & ROW_STALE))
+            continue;
+        /* A row still highlighted after the state the row before it ends
+         * with already has the right hl_oc. */
+        int oc = row->hl_oc;
+        if (editorRowHlValid(row))
+        {
+            editorRowFresh(row);
+            changed = 0;
+            continue;
+        }
+        budget -= row->size;
+        if (row->flags & ROW_RENDER)
+        {
+            editorUpdateSyntax(row);
+        }
+        else
+        {
+            int keep = row->render != NULL;
+            editorUpdateRow(row);
+            if (!keep)
+                editorRowFreeRender(row);
+        }
+        editorRowFresh(row);
+        changed = row->hl_oc != oc;
+    }
+    E.hlvalid = at;
+    if (changed)
+        editorRowStale(row, at);
+    return 1;
+}
+
+/* Compute the rendered version of 'row' if it is not up to date, leaving
+ * the syntax highlight alone: that is what rows are drawn with until the
+ * open comment state before them is known, see editorRefreshScreen(). */
+void editorRowRender(erow *row)
+{
+    if ((row->flags & ROW_WINDOW) && !editorRowWindowCovers(row))
+        row->flags &= ~ROW_RENDER;
+    if (!(row->flags & ROW_RENDER))
+        editorRenderRow(row);
+}
+
+/* Compute the rendered version and the syntax highlight of the row at
+ * index 'at', if they are not up to date. Rows are inserted and edited
+ * without doing it: this is the only place where it happens, for the rows
+ * that are displayed or searched, so the work is proportional to what is
+ * looked at, not to the size of the file. Rows don't store their index,
+ * that would need renumbering on every insert and delete: the callers know
+ * it, since they just looked the row up. */
+void editorRowMaterialize(erow *row, int at)
+{
+    int oc = row->hl_oc;
+
+    editorRowsSettle(at, LLONG_MAX);
+    editorRowRender(row);
+    if (!editorRowHlValid(row))
+        editorUpdateSyntax(row);
+    editorRowFresh(row);
+    if (E.hlvalid == at)
+        E.hlvalid = at + 1;
+    if (row->hl_oc != oc)
+        editorRowStale(editorRowNext(row), at + 1);
+}
+
+/* Return true if the content of 'row' may be read by a background job that
+ * is still running, so that it must not be modified in place: the highlight
+ * thread captured it, or the row is the copy of a row the save is writing,
+ * see row_tree.c. A row only has a bit to remember that, so it stays frozen
+ * while any job runs, until no job does any longer: at worst a row gets a
+ * copy it didn't need. */
+static int editorRowFrozen(erow *row)
+{
+    if (!(row->flags & ROW_FROZEN))
+        return 0;
+    if (E.saving || E.hlgen)
+        return 1;
+    row->flags &= ~ROW_FROZEN;
+    return 0;
+}
+
+/* Rows are edited as gap buffers: the piece of the add buffer holding the
+ * row content has a gap of unused bytes where the last edit happened, so
+ * that inserting or deleting at the cursor only moves the gap, by as many
+ * bytes as the cursor moved. The piece is laid out as the struct rowGap
+ * telling where the gap is, the content before the gap, the gap, the
+ * content after the gap, and a null term.
+ *
+ * Make sure the row content is such a piece, that it can modify in place,
+ * with a gap of at least 'need' bytes. Mapped rows can't be written, rows
+ * captured by a background job must not touch their content until the job
+ * completes, and the rows never edited have no gap: those get a new piece,
+ * like the rows whose gap is too small and that can't grow in place. The
+ * gap grows proportionally to the row, so that repeated inserts are
+ * amortized O(1). */
+static void editorRowReserve(erow *row, long long need)
+{
+    int writable = (row->flags & (ROW_GAP | ROW_MAPPED)) == ROW_GAP &&
+                   !editorRowFrozen(row);
+    struct rowGap g = editorRowGapOf(row);
+    long long after = row->size - g.at; /* Bytes after the gap. */
+    size_t len = sizeof(g) + row->size + g.len + 1; /* Piece length. */
+
+    if (writable && g.len >= need)
+        return;
+    long long gaplen = need ? need + KILO_ROW_GAP + row->size / 4 : 0;
+    if (writable && editorAddResize((char *)editorRowGap(row), len,
+                                    len + gaplen - g.len))
+    {
+        memmove(row->chars + g.at + gaplen, row->chars + g.at + g.len,
+                after + 1);
+        editorRowGap(row)->len = gaplen;
+        return;
+    }
+    char *chars = editorAddAllocAligned(sizeof(g) + row->size + gaplen + 1);
+    chars += sizeof(g);
+    memcpy(chars, row->chars, g.at);
+    memcpy(chars + g.at + gaplen, row->chars + g.at + g.len, after);
+    chars[row->size + gaplen] = '\0';
+    row->chars = chars;
+    row->flags = (row->flags & ~(ROW_MAPPED | ROW_FROZEN)) | ROW_GAP;
+    editorRowGap(row)->at = g.at;
+    editorRowGap(row)->len = gaplen;
+    /* A render pointing to the old piece would no longer follow the
+     * content: the mapped file may even be rewritten by the save. */
+    if (row->flags & ROW_ALIAS)
+        row->flags &= ~ROW_RENDER;
+}
+
+/* Move the gap of a row flagged ROW_GAP to offset 'at' of the content. */
+static void editorRowMoveGap(erow *row, long long at)
+{
+    struct rowGap *g = editorRowGap(row);
+
+    if (at < g->at)
+        memmove(row->chars + at + g->len, row->chars + at, g->at - at);
+    else if (at > g->at)
+        memmove(row->chars + g->at, row->chars + g->at + g->len,
+                at - g->at);
+    g->at = at;
+}
+
+/* Give a row its own private copy of the content before it gets modified. */
+void editorRowDetach(erow *row)
+{
+    editorRowReserve(row, 0);
+}
+
+/* Return the content of the row as 'row->size' contiguous bytes, not null
+ * terminated, moving the gap at the end if needed. This is only required to
+ * hand the content over as a whole: rendering works on the two spans around
+ * the gap directly, so that editing doesn't move the gap back and forth. */
+char *editorRowChars(erow *row)
+{
+    if ((row->flags & ROW_GAP) && editorRowGap(row)->len &&
+        editorRowGap(row)->at != row->size)
+    {
+        /* A job may be reading the content around the gap. */
+        if (editorRowFrozen(row))
+            editorRowDetach(row);
+        else
+            editorRowMoveGap(row, row->size);
+    }
+    return row->chars;
+}
+
+/* Set 'span' to the content of the row as the spans before and after the
+ * gap, for reading it without moving the gap, and return how many of them
+ * are not empty. */
+int editorRowSpans(erow *row, struct iovec *span)
+{
+    struct rowGap g = editorRowGapOf(row);
+    int n = 0;
+
+    if (g.at > 0)
+    {
+        span[n].iov_base = row->chars;
+        span[n++].iov_len = g.at;
+    }
+    if (row->size > g.at)
+    {
+        span[n].iov_base = row->chars + g.at + g.len;
+        span[n++].iov_len = row->size - g.at;
+    }
+    return n;
+}
+
+/* Return the character at offset 'at' of the row content. */
+int editorRowCharAt(erow *row, long long at)
+{
+    struct rowGap g = editorRowGapOf(row);
+
+    return row->chars[at < g.at ? at : at + g.len];
+}
+
+/* Remember that the content of the file changes starting at row 'at', so
+ * that saving can skip the rows before it. */
+void editorMarkRowDirty(int at)
+{
+    if (E.dirtyrow == -1 || at < E.dirtyrow)
+        E.dirtyrow = at;
+}
+
+/* Free row's heap allocated stuff. The content is left in the add buffer. */
 void editorFreeRow(erow *row)
 {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+    editorRowFreeRender(row);
+    editorRowFreeCols(row);
 }
 
 /* Remove the row at the specified position, shifting the remainign on the
@@ -86,36 +706,39 @@ void editorDelRow(int at)
 
     if (at >= E.numrows)
         return;
-    row = E.row + at;
+    row = editorRowAt(at);
     editorFreeRow(row);
-    memmove(E.row + at, E.row + at + 1, sizeof(E.row[0]) * (E.numrows - at - 1));
-    for (int j = at; j < E.numrows - 1; j++)
-        E.row[j].idx++;
-    E.numrows--;
+    editorRowFresh(row);
+    editorRowTreeDelete(at);
     E.dirty++;
+    editorMarkRowDirty(at);
+    editorRowStale(editorRowAt(at), at);
+    editorRowsChanged(at);
 }
 
 /* Turn the editor rows into a single heap-allocated string.
  * Returns the pointer to the heap-allocated string and populate the
  * integer pointed by 'buflen' with the size of the string, escluding
  * the final nulterm. */
-char *editorRowsToString(int *buflen)
+char *editorRowsToString(size_t *buflen)
 {
     char *buf = NULL, *p;
-    int totlen = 0;
-    int j;
+    size_t totlen = 0;
+    erow *row;
 
     /* Compute count of bytes */
-    for (j = 0; j < E.numrows; j++)
-        totlen += E.row[j].size + 1; /* +1 is for "\n" at end of every row */
+    for (row = editorRowAt(0); row; row = editorRowNext(row))
+        totlen += row->size + 1; /* +1 is for "\n" at end of every row */
     *buflen = totlen;
     totlen++; /* Also make space for nulterm */
 
     p = buf = malloc(totlen);
-    for (j = 0; j < E.numrows; j++)
+    for (row = editorRowAt(0); row; row = editorRowNext(row))
     {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
+        struct rowGap g = editorRowGapOf(row);
+        memcpy(p, row->chars, g.at);
+        memcpy(p + g.at, row->chars + g.at + g.len, row->size - g.at);
+        p += row->size;
         *p = '\n';
         p++;
     }
@@ -125,50 +748,86 @@ char *editorRowsToString(int *buflen)
 
 /* Insert a character at the specified position in a row, moving the remaining
  * chars on the right if needed. */
-void editorRowInsertChar(erow *row, int at, int c)
+void editorRowInsertChar(erow *row, long long at, int c)
 {
+    int idx = editorRowIndex(row);
+    editorMarkRowDirty(idx);
     if (at > row->size)
     {
         /* Pad the string with spaces if the insert location is outside the
          * current length by more than a single character. */
-        int padlen = at - row->size;
-        /* In the next line +2 means: new char and null term. */
-        row->chars = realloc(row->chars, row->size + padlen + 2);
-        memset(row->chars + row->size, ' ', padlen);
-        row->chars[row->size + padlen + 1] = '\0';
-        row->size += padlen + 1;
+        long long padlen = at - row->size;
+        editorRowReserve(row, padlen + 1);
+        editorRowMoveGap(row, row->size);
+        struct rowGap *g = editorRowGap(row);
+        memset(row->chars + g->at, ' ', padlen);
+        g->at += padlen;
+        g->len -= padlen;
+        row->size += padlen;
+        editorRowTreeResize(row, padlen);
     }
     else
     {
-        /* If we are in the middle of the string just make space for 1 new
-         * char plus the (already existing) null term. */
-        row->chars = realloc(row->chars, row->size + 2);
-        memmove(row->chars + at + 1, row->chars + at, row->size - at + 1);
-        row->size++;
+        /* If we are in the middle of the string just move the gap where
+         * the new char goes. */
+        editorRowReserve(row, 1);
+        editorRowMoveGap(row, at);
     }
-    row->chars[at] = c;
-    editorUpdateRow(row);
+    struct rowGap *g = editorRowGap(row);
+    row->chars[g->at++] = c;
+    g->len--;
+    row->size++;
+    editorRowTreeResize(row, 1);
+    editorRowInvalidate(row, idx, g->at - 1);
     E.dirty++;
 }
 
 /* Append the string 's' at the end of a row */
 void editorRowAppendString(erow *row, char *s, size_t len)
 {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(row->chars + row->size, s, len);
+    int idx = editorRowIndex(row);
+    editorMarkRowDirty(idx);
+    editorRowReserve(row, len);
+    editorRowMoveGap(row, row->size);
+    struct rowGap *g = editorRowGap(row);
+    memcpy(row->chars + g->at, s, len);
+    g->at += len;
+    g->len -= len;
     row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
+    editorRowTreeResize(row, len);
+    editorRowInvalidate(row, idx, g->at - len);
     E.dirty++;
 }
 
-/* Delete the character at offset 'at' from the specified row. */
-void editorRowDelChar(erow *row, int at)
+/* Delete the character at offset 'at' from the specified row: it just
+ * becomes part of the gap. */
+void editorRowDelChar(erow *row, long long at)
 {
     if (row->size <= at)
         return;
-    memmove(row->chars + at, row->chars + at + 1, row->size - at);
-    editorUpdateRow(row);
+    editorRowDetach(row);
+    int idx = editorRowIndex(row);
+    editorMarkRowDirty(idx);
+    editorRowMoveGap(row, at);
+    editorRowGap(row)->len++;
     row->size--;
+    editorRowTreeResize(row, -1);
+    editorRowInvalidate(row, idx, at);
+    E.dirty++;
+}
+
+/* Truncate the row at offset 'at', dropping the content on the right. */
+void editorRowTruncate(erow *row, long long at)
+{
+    if (row->size <= at)
+        return;
+    editorRowDetach(row);
+    int idx = editorRowIndex(row);
+    editorMarkRowDirty(idx);
+    editorRowMoveGap(row, at);
+    editorRowGap(row)->len += row->size - at;
+    editorRowTreeResize(row, at - row->size);
+    row->size = at;
+    editorRowInvalidate(row, idx, at);
     E.dirty++;
 }
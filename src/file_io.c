@@ -1,34 +1,284 @@
 #include "kilo.h"
 #include "editor.h"
 
+/* Loading of a mapped file in the background, see editorLoadMapped(). The
+ * loader thread scans the mapping for newlines step by step and publishes
+ * the offsets it finds; the main thread turns them into rows from
+ * editorLoadPoll(), so that the rows are only ever touched by the main
+ * thread. */
+struct loadJob
+{
+    pthread_t tid;
+    int threaded;            /* Runs in 'tid' and must be joined. */
+    char *map;               /* Copy of E.map / E.maplen for the thread. */
+    size_t maplen;
+    size_t from;             /* Where the loader thread starts scanning. */
+    size_t step;             /* Bytes it scans at once. */
+    int dropscanned;         /* Drop the pages already indexed. */
+    pthread_mutex_t lock;
+    lineindex ready;         /* Newlines not yet turned into rows. */
+    size_t consumed;         /* Entries of 'ready' already turned into rows. */
+    _Atomic int done;        /* The whole mapping was scanned. */
+    _Atomic int cancel;      /* Stop scanning, the file is being closed. */
+    size_t rowstart;         /* Offset of the next row to create. */
+};
+
+static struct loadJob *L = NULL; /* Load in progress, or NULL. */
+
+static void *editorLoadWorker(void *arg)
+{
+    struct loadJob *job = arg;
+    lineindex li = {NULL, 0, 0};
+
+    for (size_t pos = job->from; pos < job->maplen && !job->cancel;
+         pos += job->step)
+    {
+        size_t len = job->maplen - pos;
+        if (len > job->step)
+            len = job->step;
+        li.count = 0;
+        editorIndexLinesParallel(&li, job->map + pos, len, pos);
+        pthread_mutex_lock(&job->lock);
+        editorLineIndexAppend(&job->ready, li.off, li.count);
+        pthread_mutex_unlock(&job->lock);
+        /* In memory budget mode don't let the scan fill our resident set
+         * with the whole file. */
+        if (job->dropscanned)
+            madvise(job->map + pos, len, MADV_DONTNEED);
+    }
+    editorFreeLineIndex(&li);
+    job->done = 1;
+    return NULL;
+}
+
+/* Split the file mapping into rows. Rows reference the mapped bytes directly,
+ * so no per-line allocation or highlighting happens here. Only the first
+ * KILO_LOAD_FIRST bytes are indexed right away: a loader thread indexes the
+ * rest while the editor is already drawing and browsing the file, and the
+ * rows are appended in batches as they are found. */
+static void editorLoadMapped(void)
+{
+    struct loadJob *job = calloc(1, sizeof(*job));
+
+    job->map = E.map;
+    job->maplen = E.maplen;
+    job->from = E.maplen < KILO_LOAD_FIRST ? E.maplen : KILO_LOAD_FIRST;
+    job->dropscanned = E.membudget != 0;
+    /* Every step keeps all the CPUs busy, see editorIndexLinesParallel(),
+     * but in memory budget mode it is no bigger than the budget, since
+     * its pages are only dropped once it is scanned. */
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1)
+        ncpu = 1;
+    if (ncpu > KILO_INDEX_MAX_THREADS)
+        ncpu = KILO_INDEX_MAX_THREADS;
+    job->step = (size_t)ncpu * KILO_INDEX_CHUNK;
+    if (E.membudget && job->step > (size_t)E.membudget)
+        job->step = E.membudget > KILO_INDEX_CHUNK ? (size_t)E.membudget
+                                                   : KILO_INDEX_CHUNK;
+    pthread_mutex_init(&job->lock, NULL);
+    editorIndexLines(&job->ready, E.map, job->from, 0);
+    L = job;
+
+    if (job->from < job->maplen &&
+        pthread_create(&job->tid, NULL, editorLoadWorker, job) == 0)
+    {
+        job->threaded = 1;
+        editorLoadPoll();
+        return;
+    }
+    editorLoadWorker(job);
+    while (L)
+        editorLoadPoll();
+}
+
+/* Return the milliseconds elapsed since 'start'. */
+static long editorLoadElapsed(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 +
+           (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Called from the main loop, after every key and whenever it is idle: turn
+ * the newlines found so far by the loader into rows, for KILO_LOAD_TIME
+ * milliseconds at most, so that keys are handled right away while a file of
+ * millions of rows loads. Returns true while loading, that is, when the
+ * screen needs to be redrawn. */
+int editorLoadPoll(void)
+{
+    struct loadJob *job = L;
+    int dirty = E.dirty, dirtyrow = E.dirtyrow;
+    struct iovec lines[KILO_INSERT_BATCH];
+    int numlines = 0;
+    struct timespec start;
+
+    if (job == NULL)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&job->lock);
+    size_t j = job->consumed;
+    while (j < job->ready.count && E.membudget)
+    {
+        /* In memory budget mode the lines are added a leaf at a time,
+         * without making their rows, see editorAppendMappedLines(). */
+        size_t n = job->ready.count - j;
+        if (n > KILO_TREE_LEAF)
+            n = KILO_TREE_LEAF;
+        else if (n < KILO_TREE_LEAF && !job->done)
+            break;
+        size_t end = job->ready.off[j + n - 1] + 1;
+        editorAppendMappedLines(job->rowstart, n, end - job->rowstart);
+        job->rowstart = end;
+        j += n;
+        if (editorLoadElapsed(&start) >= KILO_LOAD_TIME)
+            break;
+    }
+    while (j < job->ready.count && !E.membudget)
+    {
+        size_t nl = job->ready.off[j++];
+        lines[numlines].iov_base = job->map + job->rowstart;
+        lines[numlines].iov_len = nl - job->rowstart;
+        job->rowstart = nl + 1;
+        if (++numlines == KILO_INSERT_BATCH || j == job->ready.count)
+        {
+            editorInsertMappedRows(E.numrows, lines, numlines);
+            numlines = 0;
+            if (editorLoadElapsed(&start) >= KILO_LOAD_TIME)
+                break;
+        }
+    }
+    job->consumed = j;
+    if (job->consumed == job->ready.count)
+        job->consumed = job->ready.count = 0;
+    int finished = job->done && job->ready.count == 0;
+    pthread_mutex_unlock(&job->lock);
+
+    /* Rows coming from the file don't make the buffer dirty. */
+    E.dirty = dirty;
+    E.dirtyrow = dirtyrow;
+    if (!finished)
+        return 1;
+
+    if (job->threaded)
+        pthread_join(job->tid, NULL);
+    if (job->rowstart < job->maplen)
+    {
+        /* Like the getline() loop, strip a '\r' only if it is the very
+         * last byte of the file. */
+        lines[0].iov_base = job->map + job->rowstart;
+        lines[0].iov_len = job->maplen - job->rowstart;
+        if (job->map[job->maplen - 1] == '\r')
+            lines[0].iov_len--;
+        editorInsertMappedRows(E.numrows, lines, 1);
+        /* This row has no newline on disk. */
+        E.dirty = dirty;
+        E.dirtyrow = E.numrows - 1;
+    }
+    pthread_mutex_destroy(&job->lock);
+    editorFreeLineIndex(&job->ready);
+    free(job);
+    L = NULL;
+    return 1;
+}
+
+/* Return how much of the file was loaded, in percent, or -1 if no load is
+ * in progress. That is the rows added so far: the loader thread scans
+ * ahead of them. */
+int editorLoadProgress(void)
+{
+    if (L == NULL)
+        return -1;
+    return (int)(L->rowstart * 100 / L->maplen);
+}
+
+/* Return true if the loader found rows that are not added yet, or is done:
+ * then editorLoadPoll() has work to do right away. */
+int editorLoadPending(void)
+{
+    if (L == NULL)
+        return 0;
+    pthread_mutex_lock(&L->lock);
+    int pending = L->consumed < L->ready.count || L->done;
+    pthread_mutex_unlock(&L->lock);
+    return pending;
+}
+
 /* Load the specified program in the editor memory and returns 0 on success
  * or 1 on error. */
 int editorOpen(char *filename)
 {
     FILE *fp;
+    struct stat st;
+    int fd;
 
     E.dirty = 0;
+    E.dirtyrow = -1;
+    memset(&E.filest, 0, sizeof(E.filest));
     free(E.filename);
     size_t fnlen = strlen(filename) + 1;
     E.filename = malloc(fnlen);
     memcpy(E.filename, filename, fnlen);
 
-    fp = fopen(filename, "r");
-    if (!fp)
+    fd = open(filename, O_RDONLY);
+    if (fd == -1)
     {
         if (errno != ENOENT)
         {
             perror("Opening file");
             exit(1);
         }
+        if (E.follow)
+            editorFollowStart(-1);
         return 1;
     }
 
+    /* Regular files are mapped and loaded lazily. Anything else (or a
+     * failing mmap) falls back to reading the file line by line. */
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        E.filest = st;
+    /* A followed file can be truncated while we look at it, it can't be
+     * mapped. */
+    if (E.follow)
+    {
+        editorFollowStart(fd);
+        E.dirty = 0;
+        E.dirtyrow = -1;
+        return 0;
+    }
+    if (E.filest.st_ino && st.st_size > 0)
+    {
+        char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            close(fd);
+            E.map = map;
+            E.maplen = st.st_size;
+            E.mapdev = st.st_dev;
+            E.mapino = st.st_ino;
+            editorLoadMapped();
+            E.dirty = 0;
+            return 0;
+        }
+    }
+
+    fp = fdopen(fd, "r");
+    if (!fp)
+    {
+        perror("Opening file");
+        exit(1);
+    }
+
     char *line = NULL;
     size_t linecap = 0;
     ssize_t linelen;
+    int terminated = 1;
     while ((linelen = getline(&line, &linecap, fp)) != -1)
     {
+        terminated = line[linelen - 1] == '\n';
         if (linelen && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
             line[--linelen] = '\0';
         editorInsertRow(E.numrows, line, linelen);
@@ -36,35 +286,478 @@ int editorOpen(char *filename)
     free(line);
     fclose(fp);
     E.dirty = 0;
+    E.dirtyrow = terminated ? -1 : E.numrows - 1;
     return 0;
 }
 
-/* Save the current file on disk. Return 0 on success, 1 on error. */
-int editorSave(void)
+/* Release everything the open file uses. The rows are not visited one by
+ * one: the tree, the add buffer and the row buffer slabs are all released
+ * in bulk, and so is the file mapping. */
+void editorCloseFile(void)
+{
+    editorSaveWait();
+    editorHighlightCancel();
+    if (L)
+    {
+        L->cancel = 1;
+        if (L->threaded)
+            pthread_join(L->tid, NULL);
+        pthread_mutex_destroy(&L->lock);
+        editorFreeLineIndex(&L->ready);
+        free(L);
+        L = NULL;
+    }
+    editorRowTreeFree();
+    editorAddFreeAll();
+    editorSlabFreeAll();
+    E.rowmem = 0;
+    E.lruhand = 0;
+    E.hlvalid = 0;
+    E.hlstale = 0;
+    if (E.map)
+        munmap(E.map, E.maplen);
+    E.map = NULL;
+    E.maplen = 0;
+}
+
+/* A save running in a background thread. It writes the row tree as it was
+ * when the save started, which stays as it is while the save runs: the
+ * leaves and nodes edited meanwhile are copies, see row_tree.c, and so is
+ * the content of the rows, see editorRowDetach(). The pieces it references
+ * are never freed, the add buffer lives as long as the file is open (see
+ * piece_table.c). */
+struct saveJob
+{
+    pthread_t tid;
+    int threaded;            /* Runs in 'tid' and must be joined. */
+    char *filename;
+    int atomic;              /* Replace the file instead of rewriting it... */
+    int tmpfd;               /* ...with this temporary file... */
+    char *tmpname;           /* ...of this name, see editorSaveTemp(). */
+    struct stat st;          /* lstat(2) of the file for atomic saves, then
+                                the stat of the file as written. */
+    struct hlJob *hl;        /* Highlight job to stop before writing. */
+    struct rowNode *root;    /* Row tree to write... */
+    int from;                /* ...from this row on... */
+    size_t off;              /* ...at this file offset. */
+    size_t len;              /* File length once saved. */
+    _Atomic size_t written;  /* Bytes on disk so far, 'off' included. */
+    _Atomic int done;
+    int err;                 /* errno of the failed step, 0 on success. */
+    int dirty;               /* E.dirty and E.dirtyrow when started. */
+    int dirtyrow;
+};
+
+static struct saveJob *S = NULL; /* Save in progress, or NULL. */
+
+/* Before the file is rewritten in place, give their own copy of the content
+ * to the mapped rows that are going to move: the bytes they reference may be
+ * overwritten before they are written out. Rows that stay at the same offset
+ * are rewritten with identical bytes, so they can keep referencing the
+ * mapping, which stays valid after the save. */
+static void editorDetachMovedRows(int from, size_t off)
+{
+    struct stat st;
+    int evict = 1;
+
+    /* Nothing to do unless we are writing over the mapped file itself. */
+    if (E.map == NULL || stat(E.filename, &st) == -1 ||
+        (st.st_dev == E.mapdev && st.st_ino == E.mapino) == 0)
+        return;
+
+    for (int at = from; at < E.numrows; at++)
+    {
+        /* Don't keep all the rows loaded in memory budget mode, as long as
+         * that frees anything: the rows detached can't be dropped, and a
+         * sweep finding nothing else goes through all of them. */
+        if (evict && at % KILO_TREE_LEAF == 0)
+        {
+            size_t rowmem = E.rowmem;
+            editorRowsEvict();
+            evict = E.rowmem <= E.membudget || E.rowmem < rowmem;
+        }
+        erow *row = editorRowAt(at);
+        if ((row->flags & ROW_MAPPED) && row->chars != E.map + off)
+            editorRowDetach(row);
+        off += row->size + 1;
+    }
+}
+
+/* Write all the 'iovcnt' buffers described by 'iov' to 'fd', resuming after
+ * short writes. The iovec array is modified. Returns 0 on success, -1 on
+ * error with errno set. */
+static int editorWriteAll(int fd, struct iovec *iov, int iovcnt)
 {
-    int len;
-    char *buf = editorRowsToString(&len);
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+        {
+            /* Skip empty buffers, or fail if nothing could be written. */
+            if (iov->iov_len != 0)
+            {
+                errno = EIO;
+                return -1;
+            }
+            iov++;
+            iovcnt--;
+            continue;
+        }
+        /* Skip what was written, possibly stopping mid buffer. */
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* Rows of a save waiting to be written, see editorWriteRows(). */
+struct saveBatch
+{
+    struct saveJob *job;
+    int fd;
+    int cnt;                        /* Buffers used in 'iov'. */
+    size_t len;                     /* Bytes they hold. */
+    struct iovec iov[KILO_SAVE_IOV];
+};
+
+/* Write the buffers of 'b' to its file. Returns 0 on success, -1 on error
+ * with errno set. */
+static int editorWriteBatch(struct saveBatch *b)
+{
+    if (editorWriteAll(b->fd, b->iov, b->cnt) == -1)
+        return -1;
+    b->job->written += b->len;
+    b->cnt = 0;
+    b->len = 0;
+    return 0;
+}
+
+/* Add 'row' and its newline to the batch 'arg', or the mapped 'lines' that
+ * already have theirs, writing the batch first if it may not have room for
+ * them. */
+static int editorWriteRow(erow *row, struct iovec *lines, void *arg)
+{
+    static char newline[] = "\n";
+    struct saveBatch *b = arg;
+
+    if (b->cnt > KILO_SAVE_IOV - 3 && editorWriteBatch(b) == -1)
+        return -1;
+    if (lines)
+    {
+        b->iov[b->cnt++] = *lines;
+        b->len += lines->iov_len;
+        return 0;
+    }
+    b->cnt += editorRowSpans(row, b->iov + b->cnt);
+    b->iov[b->cnt].iov_base = newline;
+    b->iov[b->cnt++].iov_len = 1;
+    b->len += row->size + 1;
+    return 0;
+}
+
+/* Stream the rows to 'fd' straight from the row buffers, walking the tree
+ * as the save started and batching KILO_SAVE_IOV buffers per writev(2)
+ * call, so that saving needs no copy of the file, nor even of the list of
+ * its rows, in memory. Returns 0 on success, -1 on error with errno set. */
+static int editorWriteRows(struct saveJob *job, int fd)
+{
+    struct saveBatch b = {.job = job, .fd = fd};
+
+    if (editorRowTreeWalk(job->root, job->from, editorWriteRow, &b) == -1)
+        return -1;
+    return b.cnt ? editorWriteBatch(&b) : 0;
+}
+
+/* Rewrite the file in place starting at 'job->off'. The bytes before it must
+ * already be on disk. This is only used when the file can't or shouldn't be
+ * replaced atomically, see editorSave(). */
+static int editorSaveInPlace(struct saveJob *job)
+{
+    int fd = open(job->filename, O_RDWR | O_CREAT, 0644);
     if (fd == -1)
-        goto writeerr;
+        return -1;
 
-    /* Use truncate + a single write(2) call in order to make saving
-     * a bit safer, under the limits of what we can do in a small editor. */
-    if (ftruncate(fd, len) == -1)
+    if (lseek(fd, job->off, SEEK_SET) == -1 || editorWriteRows(job, fd) == -1)
         goto writeerr;
-    if (write(fd, buf, len) != len)
+    /* The old content may be longer than what we wrote. */
+    if (ftruncate(fd, job->len) == -1 || fstat(fd, &job->st) == -1)
         goto writeerr;
+    close(fd);
+    return 0;
 
+writeerr:
     close(fd);
-    free(buf);
-    E.dirty = 0;
-    editorSetStatusMessage("%d bytes written on disk", len);
+    return -1;
+}
+
+/* Create the temporary file of an atomic save in the directory of the file,
+ * with the owner and permissions of the file, 'st'. Returns 0 on success,
+ * with the file in 'job->tmpfd' and 'job->tmpname', or -1 if that is not
+ * possible: the directory is not writable, or the file belongs to someone
+ * else and only the superuser can give the copy away. Replacing the file
+ * would then fail, or take it over, so it is saved in place instead. This
+ * runs before the save starts, since saving in place needs the rows to be
+ * prepared first, see editorSave(). */
+static int editorSaveTemp(struct saveJob *job, struct stat *st)
+{
+    size_t fnlen = strlen(job->filename);
+    char *slash = strrchr(job->filename, '/');
+    size_t dirlen = slash ? (size_t)(slash - job->filename) + 1 : 0;
+    char *tmpname = malloc(fnlen + 16);
+    struct stat tmpst;
+    int fd;
+
+    /* "dir/.name.kiloXXXXXX" */
+    memcpy(tmpname, job->filename, dirlen);
+    snprintf(tmpname + dirlen, fnlen - dirlen + 16, ".%s.kiloXXXXXX",
+             job->filename + dirlen);
+    fd = mkstemp(tmpname);
+    if (fd == -1)
+    {
+        free(tmpname);
+        return -1;
+    }
+    /* The owner first: changing it may clear the set-user-ID bits. */
+    if (fstat(fd, &tmpst) == -1 ||
+        ((tmpst.st_uid != st->st_uid || tmpst.st_gid != st->st_gid) &&
+         fchown(fd, st->st_uid, st->st_gid) == -1) ||
+        fchmod(fd, st->st_mode & 07777) == -1)
+    {
+        close(fd);
+        unlink(tmpname);
+        free(tmpname);
+        return -1;
+    }
+    job->tmpfd = fd;
+    job->tmpname = tmpname;
+    return 0;
+}
+
+/* Write the rows into the temporary file created by editorSaveTemp(), flush
+ * it to disk, then rename it over the original, so that at any point in
+ * time the file on disk is either the old or the new version. */
+static int editorSaveAtomic(struct saveJob *job)
+{
+    char *slash = strrchr(job->filename, '/');
+    size_t dirlen = slash ? (size_t)(slash - job->filename) + 1 : 0;
+    char *tmpname = job->tmpname;
+    int fd = job->tmpfd, dirfd, saved_errno;
+
+    if (editorWriteRows(job, fd) == -1 || fsync(fd) == -1)
+        goto writeerr;
+    if (fstat(fd, &job->st) == -1)
+        goto writeerr;
+    if (close(fd) == -1)
+    {
+        fd = -1;
+        goto writeerr;
+    }
+    fd = -1;
+    if (rename(tmpname, job->filename) == -1)
+        goto writeerr;
+    free(tmpname);
+
+    /* Make the rename itself durable. Failing here does not invalidate the
+     * save, so errors are ignored. */
+    if (dirlen)
+    {
+        char *dirname = strndup(job->filename, dirlen);
+        dirfd = open(dirname, O_RDONLY);
+        free(dirname);
+    }
+    else
+    {
+        dirfd = open(".", O_RDONLY);
+    }
+    if (dirfd != -1)
+    {
+        fsync(dirfd);
+        close(dirfd);
+    }
     return 0;
 
 writeerr:
-    free(buf);
+    saved_errno = errno;
     if (fd != -1)
         close(fd);
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    unlink(tmpname);
+    free(tmpname);
+    errno = saved_errno;
+    return -1;
+}
+
+static void *editorSaveWorker(void *arg)
+{
+    struct saveJob *job = arg;
+
+    if (job->hl)
+        editorHighlightJoin(job->hl);
+    int retval = job->atomic ? editorSaveAtomic(job) : editorSaveInPlace(job);
+
+    job->err = retval == -1 ? errno : 0;
+    job->done = 1;
+    return NULL;
+}
+
+/* Return true if the file on disk is still exactly what we last loaded or
+ * saved, so that the rows before E.dirtyrow don't need to be written. */
+static int editorFileUnchangedOnDisk(void)
+{
+    struct stat st;
+
+    if (E.filest.st_ino == 0 || stat(E.filename, &st) == -1)
+        return 0;
+    return st.st_dev == E.filest.st_dev && st.st_ino == E.filest.st_ino &&
+           st.st_size == E.filest.st_size &&
+           st.st_mtim.tv_sec == E.filest.st_mtim.tv_sec &&
+           st.st_mtim.tv_nsec == E.filest.st_mtim.tv_nsec;
+}
+
+/* Start saving the current file on disk. Return 0 if the save was started,
+ * 1 on error. The save itself runs in a background thread against a
+ * snapshot of the rows, so editing can continue right away:
+ * editorSavePoll() reports the outcome once it completes.
+ *
+ * When at least KILO_SAVE_INCREMENTAL_MIN bytes at the start of the file
+ * are unchanged since the last load or save, and at most
+ * KILO_SAVE_INCREMENTAL_MAX bytes follow, only the rows from E.dirtyrow
+ * onward are rewritten, in place, and the file is truncated to the new
+ * length: appending to a huge log costs as much as the appended bytes. A
+ * longer tail is not worth it: the rows that move would all need a copy of
+ * their content first, see editorDetachMovedRows(), and in memory budget
+ * mode that copy takes no more than a quarter of the budget. Otherwise
+ * existing files are replaced atomically, so a crash in the middle of the
+ * save never leaves a truncated file behind. Files that don't
+ * exist yet, files that a rename would detach from their other names
+ * (symbolic or hard links), and files that can't be replaced keeping their
+ * owner (see editorSaveTemp()) are written in place instead. */
+int editorSave(void)
+{
+    struct saveJob *job;
+    struct stat st;
+    int from = E.dirtyrow == -1 ? E.numrows : E.dirtyrow;
+    size_t off = editorRowOffset(from), len = editorRowOffset(E.numrows);
+    size_t tail = KILO_SAVE_INCREMENTAL_MAX;
+
+    if (S)
+    {
+        editorSetStatusMessage("A save is already in progress");
+        return 1;
+    }
+
+    job = calloc(1, sizeof(*job));
+    job->filename = strdup(E.filename);
+    if (E.membudget && tail > E.membudget / 4)
+        tail = E.membudget / 4;
+    if (off < KILO_SAVE_INCREMENTAL_MIN || len - off > tail ||
+        !editorFileUnchangedOnDisk())
+    {
+        from = 0;
+        off = 0;
+        if (lstat(E.filename, &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_nlink == 1 && editorSaveTemp(job, &st) == 0)
+        {
+            job->atomic = 1;
+            job->st = st;
+        }
+    }
+    if (!job->atomic)
+    {
+        /* The highlight thread may be reading the mapped rows too: the
+         * save stops it before writing over them, the main thread doesn't
+         * wait for it. */
+        job->hl = editorHighlightAbandon();
+        editorDetachMovedRows(from, off);
+    }
+
+    /* Freeze the tree as it is: nothing is done per row. */
+    E.savegen = ++E.freezegen;
+    job->root = E.rows;
+    job->from = from;
+    job->off = job->written = off;
+    job->len = len;
+    job->dirty = E.dirty;
+    job->dirtyrow = E.dirtyrow;
+    E.dirtyrow = -1; /* From now on track the edits made while saving. */
+    E.saving = 1;
+    S = job;
+
+    if (pthread_create(&job->tid, NULL, editorSaveWorker, job) == 0)
+        job->threaded = 1;
+    else
+        editorSaveWorker(job);
+    editorSetStatusMessage("Saving...");
+    return 0;
+}
+
+/* Called from the main loop: if the background save completed, reconcile
+ * the editor state with it. Returns true while a save is running or just
+ * completed, that is, when the status bar needs to be redrawn. */
+int editorSavePoll(void)
+{
+    struct saveJob *job = S;
+
+    if (job == NULL)
+        return 0;
+    if (!job->done)
+        return 1;
+    if (job->threaded)
+        pthread_join(job->tid, NULL);
+
+    S = NULL;
+    E.saving = 0;
+    editorRowTreeThawed();
+    if (job->err == 0)
+    {
+        /* Only the edits made while saving are left unsaved. */
+        E.dirty -= job->dirty;
+        E.filest = job->st;
+        editorSetStatusMessage("%zu bytes written on disk", job->len);
+    }
+    else
+    {
+        if (job->dirtyrow != -1)
+            editorMarkRowDirty(job->dirtyrow);
+        memset(&E.filest, 0, sizeof(E.filest));
+        editorSetStatusMessage("Can't save! I/O error: %s",
+                               strerror(job->err));
+    }
+    free(job->filename);
+    free(job);
     return 1;
 }
+
+/* Block until the background save, if any, completes. */
+void editorSaveWait(void)
+{
+    if (S && S->threaded)
+    {
+        pthread_join(S->tid, NULL);
+        S->threaded = 0;
+    }
+    editorSavePoll();
+}
+
+/* Return how much of the background save was written, in percent, or -1 if
+ * no save is running. */
+int editorSaveProgress(void)
+{
+    if (S == NULL)
+        return -1;
+    return S->len ? (int)(S->written * 100 / S->len) : 100;
+}
@@ -0,0 +1,213 @@
+#include "kilo.h"
+#include "editor.h"
+
+#include <sys/inotify.h>
+
+/* Follow mode (kilo -f), that works like tail -F: the file is never read
+ * again from the start, only the bytes appended to it since the last time
+ * are turned into new rows. Growth is noticed with inotify, polled by
+ * editorPoll(). One watch is on the file itself, to see it growing or
+ * being truncated; one is on its directory, to see a new file appearing
+ * under the same name when the log is rotated. The file is read
+ * KILO_FOLLOW_BATCH bytes per poll at most, starting with what it already
+ * holds, so that the editor keeps drawing and handling keys while it
+ * catches up with a big file. */
+struct follow
+{
+    int ifd;      /* inotify instance. */
+    int filewd;   /* Watch on the followed file, or -1. */
+    int dirwd;    /* Watch on its directory, or -1. */
+    int fd;       /* The followed file, or -1 if it doesn't exist yet. */
+    off_t off;    /* Bytes of 'fd' already turned into rows. */
+    int partial;  /* The last row is still waiting for its newline. */
+    int behind;   /* There may be more to read without any event. */
+    off_t size;   /* Size of 'fd' last time it was checked. */
+};
+
+static struct follow F = {-1, -1, -1, -1, 0, 0, 0, 0};
+
+/* Append 'len' bytes from the file to the buffer, completing the last row
+ * first if it had no newline yet. */
+static void editorFollowAppend(char *buf, size_t len)
+{
+    struct iovec lines[KILO_INSERT_BATCH];
+    int numlines = 0;
+
+    while (len)
+    {
+        char *nl = memchr(buf, '\n', len);
+        size_t linelen = nl ? (size_t)(nl - buf) : len;
+
+        if (F.partial)
+        {
+            editorRowAppendString(editorRowAt(E.numrows - 1), buf, linelen);
+        }
+        else
+        {
+            lines[numlines].iov_base = buf;
+            lines[numlines].iov_len = linelen;
+            if (++numlines == KILO_INSERT_BATCH)
+            {
+                editorInsertRows(E.numrows, lines, numlines);
+                numlines = 0;
+            }
+        }
+        F.partial = nl == NULL;
+        if (nl == NULL)
+            break;
+        buf += linelen + 1;
+        len -= linelen + 1;
+    }
+    editorInsertRows(E.numrows, lines, numlines);
+}
+
+/* Read what was appended to the followed file, KILO_FOLLOW_BATCH bytes at
+ * most: F.behind tells if there may be more. Returns true if rows were
+ * added or changed. */
+static int editorFollowRead(void)
+{
+    char buf[KILO_FOLLOW_READ];
+    struct stat st;
+    ssize_t nread = 0;
+    int changed = 0;
+
+    if (F.fd == -1)
+        return 0;
+    if (fstat(F.fd, &st) == 0)
+    {
+        if (st.st_size < F.off)
+        {
+            /* Truncated: whatever is there now was written after that. */
+            editorSetStatusMessage("%s: file truncated", E.filename);
+            F.off = 0;
+            F.partial = 0;
+        }
+        F.size = st.st_size;
+    }
+    off_t end = F.off + KILO_FOLLOW_BATCH;
+    while (F.off < end)
+    {
+        size_t want = end - F.off < KILO_FOLLOW_READ ? end - F.off
+                                                     : KILO_FOLLOW_READ;
+        if ((nread = pread(F.fd, buf, want, F.off)) <= 0)
+            break;
+        editorFollowAppend(buf, nread);
+        F.off += nread;
+        changed = 1;
+    }
+    F.behind = F.off == end;
+    if (F.size < F.off)
+        F.size = F.off;
+    if (changed && fstat(F.fd, &st) == 0)
+        E.filest = st;
+    return changed;
+}
+
+/* Start following the file 'fd', which is already open. */
+static void editorFollowOpen(int fd)
+{
+    F.fd = fd;
+    F.off = 0;
+    F.partial = 0;
+    F.behind = 1;
+    F.filewd = inotify_add_watch(F.ifd, E.filename,
+                                 IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                                 IN_DELETE_SELF);
+}
+
+/* Called instead of loading the file as usual when kilo runs with -f.
+ * 'fd' is the open file, or -1 if the file doesn't exist yet: in that case
+ * it is loaded when it gets created. Nothing is read here, the content is
+ * added by editorFollowPoll(), so that the first frame comes right away. */
+void editorFollowStart(int fd)
+{
+    char *dir = strdup(E.filename);
+    char *slash = strrchr(dir, '/');
+
+    if (slash == dir)
+        slash[1] = '\0'; /* File in the root directory. */
+    else if (slash)
+        slash[0] = '\0';
+    F.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (F.ifd == -1)
+    {
+        perror("inotify_init1");
+        exit(1);
+    }
+    F.dirwd = inotify_add_watch(F.ifd, slash ? dir : ".",
+                                IN_CREATE | IN_MOVED_TO);
+    free(dir);
+    if (fd != -1)
+        editorFollowOpen(fd);
+}
+
+/* Called by editorPoll(): handle the inotify events, if any, or read some
+ * more of the file if it was not all read yet. Returns true if the screen
+ * should be redrawn. */
+int editorFollowPoll(void)
+{
+    char events[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    int dirty = E.dirty, dirtyrow = E.dirtyrow;
+    int attail = E.rowoff + E.cy >= E.numrows - 1;
+    int changed = 0;
+    struct stat st;
+
+    if (F.ifd == -1)
+        return 0;
+
+    /* Which events arrived doesn't matter much: the file is checked for
+     * growth, truncation and rotation at once. */
+    if (read(F.ifd, events, sizeof(events)) <= 0 && !F.behind)
+        return 0;
+    while (read(F.ifd, events, sizeof(events)) > 0);
+
+    changed |= editorFollowRead();
+    /* A rotation is only looked at once the old file is all read, which
+     * takes more calls for a big backlog: F.behind brings them. */
+    if (!F.behind && stat(E.filename, &st) == 0 && S_ISREG(st.st_mode) &&
+        (F.fd == -1 || st.st_ino != E.filest.st_ino ||
+         st.st_dev != E.filest.st_dev))
+    {
+        /* Rotated (or created): what was written to the old file before
+         * the rotation was read, now switch to the new one. */
+        int fd = open(E.filename, O_RDONLY);
+        if (fd != -1)
+        {
+            if (F.fd != -1)
+            {
+                editorSetStatusMessage("%s: file rotated", E.filename);
+                if (F.filewd != -1)
+                    inotify_rm_watch(F.ifd, F.filewd);
+                close(F.fd);
+            }
+            editorFollowOpen(fd);
+            if (fstat(fd, &E.filest) == -1)
+                memset(&E.filest, 0, sizeof(E.filest));
+            changed |= editorFollowRead();
+        }
+    }
+
+    /* Rows coming from the file don't make the buffer dirty. */
+    E.dirty = dirty;
+    E.dirtyrow = dirtyrow;
+    if (changed && attail && E.numrows)
+    {
+        /* The cursor was at the end: keep it there. */
+        E.cx = E.coloff = 0;
+        E.rowoff = E.numrows > E.screenrows ? E.numrows - E.screenrows : 0;
+        E.cy = E.numrows - 1 - E.rowoff;
+    }
+    return changed;
+}
+
+/* Return how much of the followed file was read, in percent, while it is
+ * still catching up with what the file holds, or -1. */
+int editorFollowProgress(void)
+{
+    if (F.fd == -1 || !F.behind)
+        return -1;
+    if (F.size <= F.off)
+        return 99;
+    return (int)(F.off * 100 / F.size);
+}
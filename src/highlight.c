@@ -0,0 +1,244 @@
+#include "kilo.h"
+#include "editor.h"
+
+/* The highlight thread. All a row needs from the rows before it to be
+ * highlighted is their open comment state, hl_oc, and that is what has to
+ * be found going through the file in order after an edit opens or closes a
+ * comment, see editorRowsSettle(). The screen only does that itself for a
+ * short stretch of rows: a longer backlog is left to this thread, and the
+ * screen is drawn without highlight meanwhile, so that keys are handled
+ * right away however many rows there are to go through.
+ *
+ * The rows from E.hlvalid on are captured a batch at a time, freezing their
+ * content like a save does (see editorRowFrozen()), and the thread finds
+ * their hl_oc straight from the content while the editor keeps running. The
+ * results are published by editorHighlightPoll(), so that the rows are only
+ * ever touched by the main thread: all at once, unless rows were edited,
+ * inserted or deleted in the meantime, in which case only the ones before
+ * the first change are kept, see E.hlfence. */
+struct hlRow
+{
+    char *chars;         /* Content. */
+    long long size;
+    unsigned char oc;    /* hl_oc when captured, then the one found. */
+    unsigned char stale; /* The row was flagged ROW_STALE. */
+};
+
+struct hlJob
+{
+    pthread_t tid;
+    int threaded;        /* Runs in 'tid' and must be joined. */
+    int from;            /* Index of the first row captured. */
+    int n;               /* Rows captured. */
+    int ic;              /* hl_oc of the row before the first. */
+    struct hlRow *rows;
+    int changed;         /* The hl_oc of the last row changed. */
+    _Atomic int done;
+    _Atomic int cancel;  /* Stop, the results are not wanted. */
+};
+
+static struct hlJob *H = NULL; /* Job in progress, or NULL. */
+
+/* Go through the captured rows like editorRowsSettle() does: only the stale
+ * rows, and the ones after a row whose hl_oc changed, are looked at. */
+static void *editorHighlightWorker(void *arg)
+{
+    struct hlJob *job = arg;
+    int ic = job->ic, changed = 0;
+
+    for (int j = 0; j < job->n && !job->cancel; j++)
+    {
+        struct hlRow *r = job->rows + j;
+        int oc;
+
+        if (!changed && !r->stale)
+        {
+            ic = r->oc;
+            continue;
+        }
+        /* Tabs don't change the state, see editorMachineCompile(): the
+         * content does just as well as the render. */
+        oc = editorSyntaxOpenComment(r->chars, r->size, ic);
+        changed = oc != r->oc;
+        r->oc = oc;
+        ic = oc;
+    }
+    job->changed = changed;
+    job->done = 1;
+    return NULL;
+}
+
+/* Return how many of the 'n' rows from 'from', one at least, fit in 'max'
+ * bytes once loaded, the erow and the content of each: the byte counts of
+ * the tree tell without loading them. */
+static int editorHighlightFit(int from, int n, size_t max)
+{
+    size_t start = editorRowOffset(from);
+    int lo = 1, hi = n;
+
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (editorRowOffset(from + mid) - start + sizeof(erow) * mid <= max)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Start the highlight thread on the next KILO_HL_BATCH rows from E.hlvalid.
+ * When the rows on screen are among them the batch ends right after the
+ * screen instead, so that it can be drawn highlighted as soon as possible:
+ * the rows further down are only settled by the next jobs. */
+static void editorHighlightStart(void)
+{
+    struct hlJob *job = calloc(1, sizeof(*job));
+    int from = E.hlvalid, end = E.rowoff + E.screenrows;
+    int n = E.numrows - from;
+
+    if (n > KILO_HL_BATCH)
+        n = KILO_HL_BATCH;
+    /* The rows are loaded to capture them: in memory budget mode take no
+     * more than a quarter of the budget, see editorRowsEvict(). */
+    if (E.membudget)
+        n = editorHighlightFit(from, n, E.membudget / 4);
+    if (end > from && end < from + n)
+        n = end - from;
+    erow *prev = editorRowAt(from - 1);
+    job->from = from;
+    job->n = n;
+    job->ic = prev && prev->hl_oc;
+    job->rows = malloc(sizeof(struct hlRow) * n);
+    if (job->rows == NULL)
+    {
+        perror("Out of memory");
+        exit(1);
+    }
+
+    /* Capture the rows, freezing their buffers. */
+    E.hlgen = ++E.freezegen;
+    erow *row = editorRowAt(from);
+    for (int j = 0; j < n; j++, row = editorRowNext(row))
+    {
+        struct hlRow *r = job->rows + j;
+        r->chars = editorRowChars(row);
+        r->size = row->size;
+        row->flags |= ROW_FROZEN;
+        r->oc = row->hl_oc;
+        r->stale = (row->flags & ROW_STALE) != 0;
+    }
+    E.hlfence = INT_MAX;
+    H = job;
+
+    if (pthread_create(&job->tid, NULL, editorHighlightWorker, job) == 0)
+        job->threaded = 1;
+    else
+        editorHighlightWorker(job);
+}
+
+/* Publish the results of the finished job, for the rows before the first
+ * one flagged since it started: those are still the rows it captured, and
+ * they still come after the same rows. A row whose hl_oc changes no longer
+ * matches its highlight, even if the one before it ends with the state it
+ * was highlighted after, so the highlight is dropped: otherwise
+ * editorRowsSettle() would take the new hl_oc as up to date once that state
+ * comes back. Returns true if the rows on screen may be highlighted
+ * differently now. */
+static int editorHighlightFinish(void)
+{
+    struct hlJob *job = H;
+    int end = job->from + job->n;
+
+    if (job->threaded)
+        pthread_join(job->tid, NULL);
+    H = NULL;
+    E.hlgen = 0;
+    if (end > E.hlfence)
+        end = E.hlfence;
+    if (job->cancel || end <= job->from)
+        end = job->from;
+
+    erow *row = end > job->from ? editorRowAt(job->from) : NULL;
+    for (int j = job->from; j < end; j++, row = editorRowNext(row))
+    {
+        int oc = job->rows[j - job->from].oc;
+        if (row->hl_oc != oc)
+            row->flags &= ~ROW_HL;
+        row->hl_oc = oc;
+        editorRowFresh(row);
+    }
+    if (end > job->from && E.hlvalid < end)
+        E.hlvalid = end;
+    if (end == job->from + job->n && job->changed)
+        editorRowStale(row, end);
+
+    int redraw = end > job->from && job->from < E.rowoff + E.screenrows;
+    free(job->rows);
+    free(job);
+    return redraw;
+}
+
+/* Called by editorPoll(): publish the results of the highlight thread if it
+ * is done, and start it again if there are stale rows left. Returns true if
+ * the screen should be redrawn. */
+int editorHighlightPoll(void)
+{
+    int redraw = 0;
+
+    if (H)
+    {
+        if (!H->done)
+            return 0;
+        redraw = editorHighlightFinish();
+    }
+    if (E.hlstale && E.hlvalid < E.numrows && E.syntax &&
+        E.syntax->multiline_comment_start[0] != '\0')
+        editorHighlightStart();
+    return redraw;
+}
+
+/* Block until the highlight thread, if running, is done with its batch, and
+ * publish the results. */
+void editorHighlightWait(void)
+{
+    if (H)
+        editorHighlightFinish();
+}
+
+/* Stop the highlight thread, if running, dropping its results. */
+void editorHighlightCancel(void)
+{
+    if (H)
+    {
+        H->cancel = 1;
+        editorHighlightFinish();
+    }
+}
+
+/* Like editorHighlightCancel(), but without waiting for the thread: return
+ * the job, or NULL, for editorHighlightJoin() to wait for it from another
+ * thread. Only a save may do that: the rows the job captured stay frozen as
+ * long as it runs, see editorRowFrozen(), and the next job may start right
+ * away. */
+struct hlJob *editorHighlightAbandon(void)
+{
+    struct hlJob *job = H;
+
+    if (job == NULL)
+        return NULL;
+    job->cancel = 1;
+    H = NULL;
+    E.hlgen = 0;
+    return job;
+}
+
+/* Wait for the thread of a job given up by editorHighlightAbandon() to stop
+ * reading its rows, and free the job. */
+void editorHighlightJoin(struct hlJob *job)
+{
+    if (job->threaded)
+        pthread_join(job->tid, NULL);
+    free(job->rows);
+    free(job);
+}
@@ -0,0 +1,217 @@
+#include "kilo.h"
+#include "editor.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KILO_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* Make room in the index for 'count' more offsets, growing it
+ * geometrically. */
+static void editorLineIndexGrow(lineindex *li, size_t count)
+{
+    size_t cap = li->cap;
+
+    if (li->count + count <= cap)
+        return;
+    while (li->count + count > cap)
+        cap = cap ? cap * 2 : 1024;
+    size_t *off = realloc(li->off, sizeof(size_t) * cap);
+    if (off == NULL)
+    {
+        perror("Out of memory");
+        exit(1);
+    }
+    li->off = off;
+    li->cap = cap;
+}
+
+/* Append a newline offset to the index. */
+static inline void editorLineIndexPush(lineindex *li, size_t off)
+{
+    if (li->count == li->cap)
+        editorLineIndexGrow(li, 1);
+    li->off[li->count++] = off;
+}
+
+/* Push the offset of every bit set in 'mask', which describes the bytes
+ * starting at 'off'. */
+static inline void editorLineIndexPushMask(lineindex *li, size_t off,
+                                           uint32_t mask)
+{
+    while (mask)
+    {
+        editorLineIndexPush(li, off + __builtin_ctz(mask));
+        mask &= mask - 1;
+    }
+}
+
+/* Portable fallback, memchr() is already vectorized by most libcs. */
+static size_t editorIndexLinesScalar(lineindex *li, const char *buf,
+                                     size_t len, size_t base)
+{
+    const char *p = buf, *end = buf + len;
+
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL)
+    {
+        editorLineIndexPush(li, base + (p - buf));
+        p++;
+    }
+    return len;
+}
+
+#ifdef KILO_X86_SIMD
+/* Scan 16 bytes at a time, return how many bytes were consumed: the caller
+ * handles the tail shorter than a vector. */
+static size_t editorIndexLinesSSE2(lineindex *li, const char *buf,
+                                   size_t len, size_t base)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        editorLineIndexPushMask(li, base + i, mask);
+    }
+    return i;
+}
+
+/* Same as above using 32 byte vectors, only called when the CPU has AVX2. */
+__attribute__((target("avx2"))) static size_t
+editorIndexLinesAVX2(lineindex *li, const char *buf, size_t len, size_t base)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        editorLineIndexPushMask(li, base + i, mask);
+    }
+    return i;
+}
+
+static int has_avx2;
+static pthread_once_t has_avx2_once = PTHREAD_ONCE_INIT;
+
+static void editorIndexCpuInit(void)
+{
+    has_avx2 = __builtin_cpu_supports("avx2");
+}
+#endif
+
+/* Find out once which vector units the CPU has. This must happen before
+ * the indexing threads start, so that they only read the result. */
+static void editorIndexInit(void)
+{
+#ifdef KILO_X86_SIMD
+    pthread_once(&has_avx2_once, editorIndexCpuInit);
+#endif
+}
+
+/* Append to 'li' the offset of every '\n' in buf[0..len-1], adding 'base' to
+ * each of them. The whole buffer is scanned in a single pass with the widest
+ * vector unit available, so that loading a file costs about as much as
+ * reading it from memory. */
+void editorIndexLines(lineindex *li, const char *buf, size_t len, size_t base)
+{
+    size_t done = 0;
+
+    editorIndexInit();
+#ifdef KILO_X86_SIMD
+    if (has_avx2)
+        done = editorIndexLinesAVX2(li, buf, len, base);
+    else
+        done = editorIndexLinesSSE2(li, buf, len, base);
+#endif
+    editorIndexLinesScalar(li, buf + done, len - done, base + done);
+}
+
+/* Append 'count' offsets to the index. */
+void editorLineIndexAppend(lineindex *li, const size_t *off, size_t count)
+{
+    editorLineIndexGrow(li, count);
+    memcpy(li->off + li->count, off, sizeof(size_t) * count);
+    li->count += count;
+}
+
+void editorFreeLineIndex(lineindex *li)
+{
+    free(li->off);
+    li->off = NULL;
+    li->count = li->cap = 0;
+}
+
+/* Work item of a parallel indexing thread: one chunk of the buffer. */
+struct indexJob
+{
+    const char *buf;
+    size_t len;
+    size_t base;
+    lineindex li;
+};
+
+static void *editorIndexLinesWorker(void *arg)
+{
+    struct indexJob *job = arg;
+    editorIndexLines(&job->li, job->buf, job->len, job->base);
+    return NULL;
+}
+
+/* Like editorIndexLines() but splitting the buffer into one chunk per online
+ * CPU (each at least KILO_INDEX_CHUNK bytes). Every thread builds its own
+ * offset table, and the tables are concatenated in order at the end. Small
+ * buffers, or a failure to start threads, are handled in the calling
+ * thread. */
+void editorIndexLinesParallel(lineindex *li, const char *buf, size_t len,
+                              size_t base)
+{
+    struct indexJob jobs[KILO_INDEX_MAX_THREADS];
+    pthread_t tids[KILO_INDEX_MAX_THREADS];
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = len / KILO_INDEX_CHUNK;
+    size_t started, j;
+
+    if (ncpu > 0 && nthreads > (size_t)ncpu)
+        nthreads = ncpu;
+    if (nthreads > KILO_INDEX_MAX_THREADS)
+        nthreads = KILO_INDEX_MAX_THREADS;
+    if (nthreads < 2)
+    {
+        editorIndexLines(li, buf, len, base);
+        return;
+    }
+
+    editorIndexInit();
+    size_t chunk = len / nthreads;
+    for (j = 0; j < nthreads; j++)
+    {
+        jobs[j].buf = buf + j * chunk;
+        jobs[j].len = (j == nthreads - 1) ? len - j * chunk : chunk;
+        jobs[j].base = base + j * chunk;
+        memset(&jobs[j].li, 0, sizeof(lineindex));
+    }
+
+    /* The first chunk is scanned by the calling thread itself. */
+    for (started = 1; started < nthreads; started++)
+    {
+        if (pthread_create(&tids[started], NULL, editorIndexLinesWorker,
+                           &jobs[started]) != 0)
+            break;
+    }
+    editorIndexLinesWorker(&jobs[0]);
+    for (j = started; j < nthreads; j++)
+        editorIndexLinesWorker(&jobs[j]);
+    for (j = 1; j < started; j++)
+        pthread_join(tids[j], NULL);
+
+    /* Stitch the per chunk tables together. */
+    for (j = 0; j < nthreads; j++)
+    {
+        editorLineIndexAppend(li, jobs[j].li.off, jobs[j].li.count);
+        editorFreeLineIndex(&jobs[j].li);
+    }
+}
@@ -38,15 +38,43 @@
 
 int main(int argc, char **argv)
 {
-    if (argc != 2)
+    char *filename = NULL;
+    size_t membudget = 0;
+    int follow = 0;
+    int j;
+
+    for (j = 1; j < argc; j++)
+    {
+        if (!strcmp(argv[j], "-m") && j + 1 < argc)
+        {
+            /* Memory budget, in megabytes, for the rows: the rows not on
+             * screen are dropped and read again from the file when needed. */
+            membudget = strtoul(argv[++j], NULL, 10) * 1024 * 1024;
+        }
+        else if (!strcmp(argv[j], "-f"))
+        {
+            follow = 1;
+        }
+        else if (filename == NULL && argv[j][0] != '-')
+        {
+            filename = argv[j];
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (filename == NULL || j != argc)
     {
-        fprintf(stderr, "Usage: kilo <filename>\n");
+        fprintf(stderr, "Usage: kilo [-f] [-m megabytes] <filename>\n");
         exit(1);
     }
 
     initEditor();
-    editorSelectSyntaxHighlight(argv[1]);
-    editorOpen(argv[1]);
+    E.membudget = membudget;
+    E.follow = follow;
+    editorSelectSyntaxHighlight(filename);
+    editorOpen(filename);
     enableRawMode(STDIN_FILENO);
     editorSetStatusMessage(
         "HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
@@ -54,6 +82,8 @@ int main(int argc, char **argv)
     {
         editorRefreshScreen();
         editorProcessKeypress(STDIN_FILENO);
+        /* Keys may keep coming without the read ever timing out. */
+        editorPoll();
     }
     return 0;
 }
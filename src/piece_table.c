@@ -0,0 +1,90 @@
+#include "kilo.h"
+#include "editor.h"
+
+/* The text is stored like in a piece table, at line granularity: every row
+ * is a piece, referencing either the original file (the read only mapping,
+ * see editorInsertMappedRows()) or the add buffer, an append only area where
+ * all the content created while editing is stored. The add buffer is made
+ * of blocks that are never moved nor freed while the file is open, so the
+ * rows can point into it, and content no longer referenced by any row is
+ * simply left behind. Memory is thus proportional to the edits, not to the
+ * size of the file, and there is no per row allocation at all.
+ *
+ * Since every piece belongs to a single row, the row owning the piece at
+ * the end of the add buffer can grow in place, so typing at the end of the
+ * buffer costs no copy. */
+struct addBlock
+{
+    struct addBlock *prev;
+    size_t len;  /* Bytes of 'buf' used. */
+    size_t cap;
+    char buf[];
+};
+
+static struct addBlock *A = NULL; /* Block where new content is appended. */
+
+/* Return 'len' bytes of new space at the end of the add buffer. */
+char *editorAddAlloc(size_t len)
+{
+    if (A == NULL || A->cap - A->len < len)
+    {
+        size_t cap = len > KILO_ADD_BLOCK ? len : KILO_ADD_BLOCK;
+        struct addBlock *b = malloc(sizeof(*b) + cap);
+        if (b == NULL)
+        {
+            perror("Out of memory");
+            exit(1);
+        }
+        b->prev = A;
+        b->len = 0;
+        b->cap = cap;
+        A = b;
+    }
+    char *p = A->buf + A->len;
+    A->len += len;
+    return p;
+}
+
+/* Like editorAddAlloc(), but the space starts at a multiple of 8 bytes, for
+ * a piece that starts with a header, see editorRowReserve(). Blocks start
+ * aligned, the padding skipped is simply left behind. */
+char *editorAddAllocAligned(size_t len)
+{
+    if (A)
+    {
+        size_t pad = (8 - A->len % 8) % 8;
+        A->len = A->cap - A->len < pad + len ? A->cap : A->len + pad;
+    }
+    return editorAddAlloc(len);
+}
+
+/* Resize in place the piece 'p' of 'oldlen' bytes to 'newlen' bytes. This
+ * is always possible when it shrinks, and when it grows only if the piece
+ * is the last one of the add buffer and there is room after it. Returns
+ * true on success. */
+int editorAddResize(char *p, size_t oldlen, size_t newlen)
+{
+    int last = A && p + oldlen == A->buf + A->len;
+
+    if (newlen <= oldlen)
+    {
+        if (last)
+            A->len -= oldlen - newlen;
+        return 1;
+    }
+    if (!last || A->cap - A->len < newlen - oldlen)
+        return 0;
+    A->len += newlen - oldlen;
+    return 1;
+}
+
+/* Release the whole add buffer, once no row references it any longer. */
+void editorAddFreeAll(void)
+{
+    while (A)
+    {
+        struct addBlock *prev = A->prev;
+        free(A);
+        A = prev;
+    }
+}
@@ -0,0 +1,847 @@
+#include "kilo.h"
+#include "editor.h"
+
+/* The row tree, see the comment above struct rowLeaf in kilo.h. The root is
+ * always a node, even when it only has a single leaf. Leaves are kept at
+ * least 1/4 full when possible, merging them with a sibling when they get
+ * smaller, and the same is done for the nodes, so the tree stays shallow:
+ * three levels are enough for a quarter of a billion rows.
+ *
+ * A save writes the tree as it was when it started, from its own thread,
+ * while editing goes on: the leaves and nodes that existed then, those with
+ * a generation up to E.savegen, are frozen until it completes. The main
+ * thread never modifies them, it copies them first along with their path to
+ * the root, and the save keeps reading the old ones. Only their 'parent',
+ * 'prev' and 'next' fields are still updated, since the save doesn't follow
+ * them. Rows are only ever returned from leaves that are not frozen, so all
+ * the rest of kilo needs to know is that their content may be shared with
+ * the save, see ROW_FROZEN.
+ *
+ * The rows of a leaf are in an array of their own, which in memory budget
+ * mode is dropped once they are nothing but lines of the file mapping: the
+ * leaf then only remembers where those lines are and the few bits of state
+ * the rows can't do without, and the rows are made again from the mapping
+ * when the leaf is used, see editorTreeLoad(). The loader adds the rows of
+ * big files that way, so that the tree is a sparse index of the file, one
+ * offset for KILO_TREE_LEAF lines. */
+
+_Static_assert(KILO_TREE_LEAF <= 64, "the bits of a leaf are kept in 64");
+
+#define LEAF_ROWS (sizeof(erow) * KILO_TREE_LEAF) /* Size of leaf->rows. */
+
+static void **retired = NULL; /* Frozen leaves and nodes already copied. */
+static int numretired = 0, capretired = 0;
+
+static void *editorTreeAlloc(size_t size)
+{
+    void *p = calloc(1, size);
+    if (p == NULL)
+    {
+        perror("Out of memory");
+        exit(1);
+    }
+    return p;
+}
+
+/* Return a new leaf, with room for its rows if 'loaded'. */
+static struct rowLeaf *editorTreeNewLeaf(int loaded)
+{
+    struct rowLeaf *leaf = editorTreeAlloc(sizeof(*leaf));
+    leaf->gen = E.freezegen + 1;
+    if (loaded)
+    {
+        leaf->rows = editorTreeAlloc(LEAF_ROWS);
+        E.rowmem += LEAF_ROWS;
+    }
+    return leaf;
+}
+
+/* Free a leaf that was removed from the tree. */
+static void editorTreeFreeLeaf(struct rowLeaf *leaf)
+{
+    if (leaf->rows)
+        E.rowmem -= LEAF_ROWS + leaf->mapmem;
+    free(leaf->rows);
+    free(leaf);
+}
+
+static struct rowNode *editorTreeNewNode(void)
+{
+    struct rowNode *node = editorTreeAlloc(sizeof(*node));
+    node->gen = E.freezegen + 1;
+    return node;
+}
+
+/* Return the position of 'child' among the children of 'node'. */
+static int editorTreeSlot(struct rowNode *node, void *child)
+{
+    int i = 0;
+    while (node->child[i] != child)
+        i++;
+    return i;
+}
+
+/* Return how many rows there are under 'node'. */
+static int editorTreeSum(struct rowNode *node)
+{
+    int sum = 0;
+    for (int i = 0; i < node->n; i++)
+        sum += node->count[i];
+    return sum;
+}
+
+/* Return how many bytes the rows under 'node' take in the file. */
+static long long editorTreeBytes(struct rowNode *node)
+{
+    long long sum = 0;
+    for (int i = 0; i < node->n; i++)
+        sum += node->bytes[i];
+    return sum;
+}
+
+/* Recompute the bytes of 'leaf' from its rows. */
+static void editorTreeLeafBytes(struct rowLeaf *leaf)
+{
+    leaf->bytes = 0;
+    for (int j = 0; j < leaf->n; j++)
+        leaf->bytes += leaf->rows[j].size + 1;
+}
+
+/* Set the row and byte counts of the child at index 'i' of 'node'. */
+static void editorTreeCount(struct rowNode *node, int i)
+{
+    if (node->leaves)
+    {
+        struct rowLeaf *leaf = node->child[i];
+        node->count[i] = leaf->n;
+        node->bytes[i] = leaf->bytes;
+    }
+    else
+    {
+        node->count[i] = editorTreeSum(node->child[i]);
+        node->bytes[i] = editorTreeBytes(node->child[i]);
+    }
+}
+
+/* Make 'node' the parent of its children from the one at index 'from'. */
+static void editorTreeAdopt(struct rowNode *node, int from)
+{
+    for (int i = from; i < node->n; i++)
+    {
+        if (node->leaves)
+            ((struct rowLeaf *)node->child[i])->parent = node;
+        else
+            ((struct rowNode *)node->child[i])->parent = node;
+    }
+}
+
+/* Return true if the leaf or node of generation 'gen' is read by the
+ * running save. */
+static int editorTreeFrozen(int gen)
+{
+    return E.saving && gen <= E.savegen;
+}
+
+/* Remember to free 'p', a frozen leaf or node that was copied, when the save
+ * completes. */
+static void editorTreeRetire(void *p)
+{
+    if (numretired == capretired)
+    {
+        capretired = capretired ? capretired * 2 : 64;
+        retired = realloc(retired, sizeof(void *) * capretired);
+        if (retired == NULL)
+        {
+            perror("Out of memory");
+            exit(1);
+        }
+    }
+    retired[numretired++] = p;
+}
+
+/* Return 'node', or a copy of it that can be modified if it is frozen,
+ * which takes its place in the tree: its ancestors are copied as well. */
+static struct rowNode *editorTreeThawNode(struct rowNode *node)
+{
+    if (!editorTreeFrozen(node->gen))
+        return node;
+    struct rowNode *parent =
+        node->parent ? editorTreeThawNode(node->parent) : NULL;
+    struct rowNode *copy = editorTreeNewNode();
+    int gen = copy->gen;
+
+    memcpy(copy, node, sizeof(*copy));
+    copy->gen = gen;
+    if (parent)
+        parent->child[editorTreeSlot(parent, node)] = copy;
+    else
+        E.rows = copy;
+    editorTreeAdopt(copy, 0);
+    editorTreeRetire(node);
+    return copy;
+}
+
+/* Return 'leaf', or a copy of it that can be modified if it is frozen, see
+ * editorTreeThawNode(). The content of the copied rows stays shared with
+ * the save, so they are flagged ROW_FROZEN. */
+static struct rowLeaf *editorTreeThawLeaf(struct rowLeaf *leaf)
+{
+    if (leaf == NULL || !editorTreeFrozen(leaf->gen))
+        return leaf;
+    struct rowNode *parent = editorTreeThawNode(leaf->parent);
+    struct rowLeaf *copy = editorTreeNewLeaf(0);
+    int gen = copy->gen;
+
+    memcpy(copy, leaf, sizeof(*copy));
+    copy->gen = gen;
+    if (leaf->rows)
+    {
+        copy->rows = editorTreeAlloc(LEAF_ROWS);
+        memcpy(copy->rows, leaf->rows, sizeof(erow) * leaf->n);
+        editorTreeRetire(leaf->rows);
+    }
+    for (int j = 0; j < copy->n && copy->rows; j++)
+    {
+        copy->rows[j].leaf = copy;
+        copy->rows[j].flags |= ROW_FROZEN;
+    }
+    parent->child[editorTreeSlot(parent, leaf)] = copy;
+    if (copy->prev)
+        copy->prev->next = copy;
+    if (copy->next)
+        copy->next->prev = copy;
+    editorTreeRetire(leaf);
+    return copy;
+}
+
+/* Free the leaves and nodes copied while the save ran, once it completed. */
+void editorRowTreeThawed(void)
+{
+    for (int j = 0; j < numretired; j++)
+        free(retired[j]);
+    free(retired);
+    retired = NULL;
+    numretired = capretired = 0;
+}
+
+/* Return 'leaf' ready to be used by the main thread: not frozen, see
+ * editorTreeThawLeaf(), and with its rows, made again from the lines of the
+ * mapping if they were dropped, see editorTreeUnload(). Their render and
+ * highlight are computed again once needed, like for rows just loaded, but
+ * they keep their hl_oc and ROW_STALE, that tell how far the rows before
+ * the screen are settled, see editorRowsSettle(). */
+static struct rowLeaf *editorTreeLoad(struct rowLeaf *leaf)
+{
+    leaf = editorTreeThawLeaf(leaf);
+    if (leaf == NULL)
+        return NULL;
+    leaf->used = 1;
+    if (leaf->rows)
+        return leaf;
+    leaf->rows = editorTreeAlloc(LEAF_ROWS);
+    leaf->mapmem = leaf->bytes;
+    E.rowmem += LEAF_ROWS + leaf->mapmem;
+
+    char *p = E.map + leaf->mapoff;
+    for (int j = 0; j < leaf->n; j++)
+    {
+        erow *row = leaf->rows + j;
+        char *nl = memchr(p, '\n', E.map + E.maplen - p);
+        row->leaf = leaf;
+        row->chars = p;
+        row->size = nl - p;
+        row->flags = ROW_MAPPED | (leaf->stale >> j & 1 ? ROW_STALE : 0);
+        row->hl_oc = leaf->oc >> j & 1;
+        p = nl + 1;
+    }
+    return leaf;
+}
+
+/* Return true if the rows of 'leaf' are lines of the file mapping, one
+ * after the other and as they are on disk, with their newline: they can be
+ * made again from the mapping. */
+static int editorTreeUnloadable(struct rowLeaf *leaf)
+{
+    char *p = leaf->n ? leaf->rows[0].chars : NULL;
+
+    for (int j = 0; j < leaf->n; j++)
+    {
+        erow *row = leaf->rows + j;
+        /* Only the last line of the file may have no newline. */
+        if (!(row->flags & ROW_MAPPED) || row->chars != p ||
+            p + row->size + 1 >= E.map + E.maplen)
+            return 0;
+        p += row->size + 1;
+    }
+    return leaf->n > 0;
+}
+
+/* Drop the rows of 'leaf', that editorTreeUnloadable() allows, keeping what
+ * editorTreeLoad() needs to make them again. The mapped pages that only
+ * hold their lines are clean: the kernel may reclaim them right away, they
+ * are read back from the file if needed. */
+static void editorTreeUnload(struct rowLeaf *leaf)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    leaf->mapoff = leaf->rows[0].chars - E.map;
+    leaf->oc = leaf->stale = 0;
+    for (int j = 0; j < leaf->n; j++)
+    {
+        leaf->oc |= (uint64_t)leaf->rows[j].hl_oc << j;
+        leaf->stale |= (uint64_t)!!(leaf->rows[j].flags & ROW_STALE) << j;
+    }
+    free(leaf->rows);
+    leaf->rows = NULL;
+    E.rowmem -= LEAF_ROWS + leaf->mapmem;
+    leaf->mapmem = 0;
+
+    size_t from = (leaf->mapoff + page - 1) / page * page;
+    size_t to = (leaf->mapoff + leaf->bytes) / page * page;
+    if (to > from)
+        madvise(E.map + from, to - from, MADV_DONTNEED);
+}
+
+/* Refresh the row and byte counts of 'child', a child of 'node', and the
+ * ones of all its ancestors, after rows were added to or removed from
+ * 'child'. */
+static void editorTreeUpdate(struct rowNode *node, void *child)
+{
+    for (; node; child = node, node = node->parent)
+        editorTreeCount(node, editorTreeSlot(node, child));
+}
+
+/* Insert 'child' at index 'at' among the children of 'node', splitting
+ * 'node' in two if it is full. */
+static void editorTreeInsertChild(struct rowNode *node, int at, void *child)
+{
+    if (node->n == KILO_TREE_FANOUT)
+    {
+        struct rowNode *right = editorTreeNewNode();
+        int half = node->n / 2;
+
+        right->leaves = node->leaves;
+        right->n = node->n - half;
+        memcpy(right->child, node->child + half, sizeof(void *) * right->n);
+        memcpy(right->count, node->count + half, sizeof(int) * right->n);
+        memcpy(right->bytes, node->bytes + half,
+               sizeof(long long) * right->n);
+        node->n = half;
+        editorTreeAdopt(right, 0);
+        if (node->parent == NULL)
+        {
+            /* Splitting the root: the tree gets one level taller. */
+            struct rowNode *root = editorTreeNewNode();
+            root->n = 1;
+            root->child[0] = node;
+            node->parent = root;
+            E.rows = root;
+        }
+        editorTreeInsertChild(node->parent,
+                              editorTreeSlot(node->parent, node) + 1, right);
+        editorTreeUpdate(node->parent, node);
+        if (at > half)
+        {
+            node = right;
+            at -= half;
+        }
+    }
+    memmove(node->child + at + 1, node->child + at,
+            sizeof(void *) * (node->n - at));
+    memmove(node->count + at + 1, node->count + at,
+            sizeof(int) * (node->n - at));
+    memmove(node->bytes + at + 1, node->bytes + at,
+            sizeof(long long) * (node->n - at));
+    node->child[at] = child;
+    node->n++;
+    editorTreeAdopt(node, at);
+    editorTreeCount(node, at);
+    editorTreeUpdate(node->parent, node);
+}
+
+/* Remove the child at index 'at' of 'node', which the caller frees. Nodes
+ * left empty are removed as well, and nodes left too small are merged with
+ * a sibling if they fit together. */
+static void editorTreeRemoveChild(struct rowNode *node, int at)
+{
+    memmove(node->child + at, node->child + at + 1,
+            sizeof(void *) * (node->n - at - 1));
+    memmove(node->count + at, node->count + at + 1,
+            sizeof(int) * (node->n - at - 1));
+    memmove(node->bytes + at, node->bytes + at + 1,
+            sizeof(long long) * (node->n - at - 1));
+    node->n--;
+
+    struct rowNode *parent = node->parent;
+    if (parent == NULL)
+    {
+        /* A root with a single node child is a level too much. */
+        if (node->n == 1 && !node->leaves)
+        {
+            E.rows = node->child[0];
+            E.rows->parent = NULL;
+            free(node);
+        }
+        return;
+    }
+    editorTreeUpdate(parent, node);
+    if (node->n == 0)
+    {
+        editorTreeRemoveChild(parent, editorTreeSlot(parent, node));
+        free(node);
+        return;
+    }
+    if (node->n >= KILO_TREE_FANOUT / 4)
+        return;
+
+    int slot = editorTreeSlot(parent, node);
+    struct rowNode *left, *right;
+    if (slot + 1 < parent->n)
+    {
+        left = node;
+        right = editorTreeThawNode(parent->child[slot + 1]);
+    }
+    else if (slot > 0)
+    {
+        left = editorTreeThawNode(parent->child[slot - 1]);
+        right = node;
+    }
+    else
+    {
+        return;
+    }
+    if (left->n + right->n > KILO_TREE_FANOUT)
+        return;
+    memcpy(left->child + left->n, right->child, sizeof(void *) * right->n);
+    memcpy(left->count + left->n, right->count, sizeof(int) * right->n);
+    memcpy(left->bytes + left->n, right->bytes,
+           sizeof(long long) * right->n);
+    left->n += right->n;
+    editorTreeAdopt(left, left->n - right->n);
+    editorTreeUpdate(parent, left);
+    editorTreeRemoveChild(parent, editorTreeSlot(parent, right));
+    free(right);
+}
+
+/* Return the leaf holding the row at index 'at', and in '*pos' the position
+ * of the row in the leaf. For 'at' equal to E.numrows return the last leaf,
+ * and the position just after its last row. The leaf is returned as it is,
+ * see editorTreeFind() to use its rows. */
+static struct rowLeaf *editorTreePeek(int at, int *pos)
+{
+    struct rowNode *node = E.rows;
+
+    for (;;)
+    {
+        int i = 0;
+        while (i < node->n - 1 && at >= node->count[i])
+            at -= node->count[i++];
+        if (node->leaves)
+        {
+            *pos = at;
+            return node->child[i];
+        }
+        node = node->child[i];
+    }
+}
+
+/* Like editorTreePeek(), for a leaf whose rows are used, see
+ * editorTreeLoad(). */
+static struct rowLeaf *editorTreeFind(int at, int *pos)
+{
+    return editorTreeLoad(editorTreePeek(at, pos));
+}
+
+/* Return the row at index 'at', or NULL if there is no such row. */
+erow *editorRowAt(int at)
+{
+    int pos;
+
+    if (at < 0 || at >= E.numrows)
+        return NULL;
+    struct rowLeaf *leaf = editorTreeFind(at, &pos);
+    return leaf->rows + pos;
+}
+
+/* Return the offset in the file of the row at index 'at', that is the bytes
+ * of the rows before it, newlines included. For 'at' equal to E.numrows
+ * that is the length of the whole file. */
+size_t editorRowOffset(int at)
+{
+    struct rowNode *node = E.rows;
+    size_t off = 0;
+
+    if (node == NULL)
+        return 0;
+    for (;;)
+    {
+        int i = 0;
+        while (i < node->n - 1 && at >= node->count[i])
+        {
+            at -= node->count[i];
+            off += node->bytes[i++];
+        }
+        if (node->leaves)
+        {
+            struct rowLeaf *leaf = node->child[i];
+            if (at == leaf->n)
+                return off + leaf->bytes;
+            if (leaf->rows == NULL)
+            {
+                /* The lines are not loaded: count them on the mapping. */
+                char *start = E.map + leaf->mapoff, *p = start;
+                for (int j = 0; j < at; j++)
+                    p = (char *)memchr(p, '\n', E.map + E.maplen - p) + 1;
+                return off + (p - start);
+            }
+            for (int j = 0; j < at; j++)
+                off += leaf->rows[j].size + 1;
+            return off;
+        }
+        node = node->child[i];
+    }
+}
+
+/* The content of 'row' grew by 'delta' bytes, or shrank if negative: update
+ * the byte counts up to the root. */
+void editorRowTreeResize(erow *row, long long delta)
+{
+    struct rowLeaf *leaf = row->leaf;
+    void *child = leaf;
+
+    leaf->bytes += delta;
+    for (struct rowNode *node = leaf->parent; node;
+         child = node, node = node->parent)
+        node->bytes[editorTreeSlot(node, child)] += delta;
+}
+
+/* Call 'visit' on every row under 'node' from index 'from', in order, until
+ * it returns -1: on the row itself, or on the lines of the mapping of a
+ * whole leaf whose rows are not loaded, newlines included. Returns 0, or
+ * -1 if 'visit' did. */
+static int editorTreeWalk(struct rowNode *node, int from,
+                          int (*visit)(erow *row, struct iovec *lines,
+                                       void *arg),
+                          void *arg)
+{
+    for (int i = 0; i < node->n; i++)
+    {
+        if (from >= node->count[i])
+        {
+            from -= node->count[i];
+            continue;
+        }
+        if (node->leaves)
+        {
+            struct rowLeaf *leaf = node->child[i];
+            for (int j = from; j < leaf->n && leaf->rows; j++)
+                if (visit(leaf->rows + j, NULL, arg) == -1)
+                    return -1;
+            if (leaf->rows == NULL)
+            {
+                char *p = E.map + leaf->mapoff;
+                for (int j = 0; j < from; j++)
+                    p = (char *)memchr(p, '\n', E.map + E.maplen - p) + 1;
+                struct iovec lines = {
+                    p, leaf->bytes - (p - (E.map + leaf->mapoff))};
+                if (visit(NULL, &lines, arg) == -1)
+                    return -1;
+            }
+        }
+        else if (editorTreeWalk(node->child[i], from, visit, arg) == -1)
+        {
+            return -1;
+        }
+        from = 0;
+    }
+    return 0;
+}
+
+/* Call 'visit' on the rows of the tree of root 'root' from index 'from', as
+ * editorTreeWalk() does. This is how the save reads the tree as it was when
+ * it started, from its own thread: only the fields that stay the same while
+ * the leaves and nodes are frozen are used. */
+int editorRowTreeWalk(struct rowNode *root, int from,
+                      int (*visit)(erow *row, struct iovec *lines,
+                                   void *arg),
+                      void *arg)
+{
+    return root ? editorTreeWalk(root, from, visit, arg) : 0;
+}
+
+/* Return the index of 'row' in the file. */
+int editorRowIndex(erow *row)
+{
+    struct rowLeaf *leaf = row->leaf;
+    int idx = row - leaf->rows;
+    void *child = leaf;
+
+    for (struct rowNode *node = leaf->parent; node;
+         child = node, node = node->parent)
+    {
+        for (int i = 0; node->child[i] != child; i++)
+            idx += node->count[i];
+    }
+    return idx;
+}
+
+/* Return the row after 'row', or NULL if it is the last one. */
+erow *editorRowNext(erow *row)
+{
+    struct rowLeaf *leaf = row->leaf;
+
+    if (row + 1 < leaf->rows + leaf->n)
+        return row + 1;
+    leaf = editorTreeLoad(leaf->next);
+    return leaf ? leaf->rows : NULL;
+}
+
+/* Return the row before 'row', or NULL if it is the first one. */
+erow *editorRowPrev(erow *row)
+{
+    struct rowLeaf *leaf = row->leaf;
+
+    if (row > leaf->rows)
+        return row - 1;
+    leaf = editorTreeLoad(leaf->prev);
+    return leaf ? leaf->rows + leaf->n - 1 : NULL;
+}
+
+/* Move the rows of 'leaf' from index 'from' on to a new leaf, placed right
+ * after it in the tree, and return the new leaf. */
+static struct rowLeaf *editorTreeSplitLeaf(struct rowLeaf *leaf, int from)
+{
+    struct rowLeaf *right = editorTreeNewLeaf(1);
+
+    right->n = leaf->n - from;
+    memcpy(right->rows, leaf->rows + from, sizeof(erow) * right->n);
+    for (int j = 0; j < right->n; j++)
+        right->rows[j].leaf = right;
+    leaf->n = from;
+    editorTreeLeafBytes(leaf);
+    editorTreeLeafBytes(right);
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    leaf->next = right;
+    editorTreeInsertChild(leaf->parent,
+                          editorTreeSlot(leaf->parent, leaf) + 1, right);
+    editorTreeUpdate(leaf->parent, leaf);
+    return right;
+}
+
+/* Make room for 'n' rows at index 'at', with every field cleared but their
+ * size, taken from 'lines', and return the first one: the others follow it,
+ * see editorRowNext(). If they don't fit
+ * in the leaf where they go, the leaf is split at 'at' and the rows fill its
+ * first part, then as many new full leaves as needed. The tree is thus
+ * updated once per leaf, not once per row, and appending at the end of the
+ * file, like loading does, leaves all the leaves full. */
+erow *editorRowTreeInsert(int at, struct iovec *lines, int n)
+{
+    struct rowLeaf *leaf;
+    erow *first = NULL;
+    int pos;
+
+    if (E.rows == NULL)
+    {
+        E.rows = editorTreeNewNode();
+        E.rows->leaves = 1;
+        editorTreeInsertChild(E.rows, 0, editorTreeNewLeaf(1));
+    }
+    leaf = editorTreeFind(at, &pos);
+    if (leaf->n + n > KILO_TREE_LEAF && pos < leaf->n)
+        editorTreeSplitLeaf(leaf, pos);
+    while (n)
+    {
+        if (leaf->n == KILO_TREE_LEAF)
+        {
+            leaf = editorTreeSplitLeaf(leaf, leaf->n);
+            pos = 0;
+        }
+        int fill = KILO_TREE_LEAF - leaf->n;
+        if (fill > n)
+            fill = n;
+        memmove(leaf->rows + pos + fill, leaf->rows + pos,
+                sizeof(erow) * (leaf->n - pos));
+        memset(leaf->rows + pos, 0, sizeof(erow) * fill);
+        for (int j = pos; j < pos + fill; j++, lines++)
+        {
+            leaf->rows[j].leaf = leaf;
+            leaf->rows[j].size = lines->iov_len;
+            leaf->bytes += lines->iov_len + 1;
+        }
+        if (first == NULL)
+            first = leaf->rows + pos;
+        leaf->n += fill;
+        E.numrows += fill;
+        n -= fill;
+        pos += fill;
+        editorTreeUpdate(leaf->parent, leaf);
+    }
+    return first;
+}
+
+/* Append 'n' rows, at most KILO_TREE_LEAF, for the lines of the file
+ * mapping at offset 'off', 'bytes' long with their newlines, as a leaf that
+ * is not loaded: nothing at all is done per row until they are used, see
+ * editorTreeLoad(). The rows are ROW_STALE, like the rows just inserted. */
+void editorRowTreeAppendMapped(size_t off, int n, size_t bytes)
+{
+    struct rowLeaf *leaf = editorTreeNewLeaf(0);
+
+    leaf->n = n;
+    leaf->bytes = bytes;
+    leaf->mapoff = off;
+    leaf->stale = n == 64 ? UINT64_MAX : ((uint64_t)1 << n) - 1;
+    if (E.rows == NULL)
+    {
+        E.rows = editorTreeNewNode();
+        E.rows->leaves = 1;
+    }
+    struct rowNode *node = E.rows;
+    while (!node->leaves)
+        node = node->child[node->n - 1];
+    node = editorTreeThawNode(node);
+    if (node->n)
+    {
+        leaf->prev = node->child[node->n - 1];
+        leaf->prev->next = leaf;
+    }
+    editorTreeInsertChild(node, node->n, leaf);
+    E.numrows += n;
+}
+
+/* Remove the row at index 'at' from the tree. Its buffers must have been
+ * freed already. */
+void editorRowTreeDelete(int at)
+{
+    int pos;
+    struct rowLeaf *leaf = editorTreeFind(at, &pos);
+
+    leaf->bytes -= leaf->rows[pos].size + 1;
+    memmove(leaf->rows + pos, leaf->rows + pos + 1,
+            sizeof(erow) * (leaf->n - pos - 1));
+    leaf->n--;
+    E.numrows--;
+    editorTreeUpdate(leaf->parent, leaf);
+
+    /* Drop empty leaves and merge small ones with a sibling, but always
+     * keep at least one leaf. */
+    if (leaf->n >= KILO_TREE_LEAF / 4 || (!leaf->prev && !leaf->next))
+        return;
+    struct rowNode *parent = leaf->parent;
+    struct rowLeaf *left, *right;
+    if (leaf->n == 0)
+    {
+        left = leaf->prev;
+        right = leaf;
+    }
+    else if (leaf->next && leaf->next->parent == parent)
+    {
+        left = leaf;
+        right = editorTreeLoad(leaf->next);
+    }
+    else if (leaf->prev && leaf->prev->parent == parent)
+    {
+        left = editorTreeLoad(leaf->prev);
+        right = leaf;
+    }
+    else
+    {
+        return;
+    }
+    if (left && left->n + right->n > KILO_TREE_LEAF)
+        return;
+    if (right->n)
+    {
+        left = editorTreeLoad(left);
+        memcpy(left->rows + left->n, right->rows, sizeof(erow) * right->n);
+        for (int j = left->n; j < left->n + right->n; j++)
+            left->rows[j].leaf = left;
+        left->n += right->n;
+        left->bytes += right->bytes;
+        left->mapmem += right->mapmem;
+        right->mapmem = 0;
+        editorTreeUpdate(left->parent, left);
+    }
+    if (right->prev)
+        right->prev->next = right->next;
+    if (right->next)
+        right->next->prev = right->prev;
+    editorTreeRemoveChild(right->parent,
+                          editorTreeSlot(right->parent, right));
+    editorTreeFreeLeaf(right);
+}
+
+/* Free the nodes under 'node', and 'node' itself. */
+static void editorTreeFreeNode(struct rowNode *node)
+{
+    for (int i = 0; i < node->n; i++)
+    {
+        if (node->leaves)
+            editorTreeFreeLeaf(node->child[i]);
+        else
+            editorTreeFreeNode(node->child[i]);
+    }
+    free(node);
+}
+
+/* In memory budget mode (E.membudget not zero) release the rows that were
+ * not used recently, so that once the budget is exceeded they take at most
+ * 3/4 of it again. This is a CLOCK approximation of LRU: a hand sweeps the
+ * leaves, releasing the render and highlight of their rows, and the rows
+ * themselves when they can be made again from the file mapping, unless the
+ * leaf was used since the hand last passed by. The rows on screen are
+ * never released, and neither are the ones the save is writing: memory
+ * may go over the budget until it completes. Edited rows are not lines of
+ * the mapping any longer, only their render and highlight are released.
+ *
+ * This invalidates pointers to rows: it is only called where none is held,
+ * once per frame from editorRefreshScreen(), and from the loops over all
+ * the rows. */
+void editorRowsEvict(void)
+{
+    size_t target = E.membudget / 4 * 3;
+    int pos;
+
+    if (E.membudget == 0 || E.rowmem <= E.membudget || E.rows == NULL)
+        return;
+    if (E.lruhand >= E.numrows)
+        E.lruhand = 0;
+    struct rowLeaf *leaf = editorTreePeek(E.lruhand, &pos);
+    int at = E.lruhand - pos; /* Index of the first row of 'leaf'. */
+    for (long swept = 0; swept < 2L * E.numrows && E.rowmem > target;
+         swept += leaf->n + 1, at += leaf->n, leaf = leaf->next)
+    {
+        if (leaf == NULL)
+        {
+            leaf = editorTreePeek(0, &pos);
+            at = 0;
+        }
+        if (leaf->rows == NULL || editorTreeFrozen(leaf->gen) ||
+            (at < E.rowoff + E.screenrows && at + leaf->n > E.rowoff))
+            continue;
+        if (leaf->used)
+        {
+            leaf->used = 0;
+            continue;
+        }
+        for (int j = 0; j < leaf->n; j++)
+            editorFreeRow(leaf->rows + j);
+        if (editorTreeUnloadable(leaf))
+            editorTreeUnload(leaf);
+    }
+    E.lruhand = at;
+}
+
+/* Drop all the rows at once. Their buffers are not freed here: they live in
+ * the add buffer and in the row slabs, that are released in bulk too. */
+void editorRowTreeFree(void)
+{
+    if (E.rows)
+        editorTreeFreeNode(E.rows);
+    E.rows = NULL;
+    E.numrows = 0;
+}
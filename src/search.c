@@ -2,16 +2,24 @@
 #include "editor.h"
 #include "terminal.h"
 
-#define FIND_RESTORE_HL                                                            \
-    do                                                                             \
-    {                                                                              \
-        if (saved_hl)                                                              \
-        {                                                                          \
-            memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize); \
-            free(saved_hl);                                                        \
-            saved_hl = NULL;                                                       \
-        }                                                                          \
-    } while (0)
+/* Return the first occurrence of 'query' in the 'len' bytes at 's', or NULL.
+ * Row content is not null terminated, so strstr() can't be used. */
+static char *editorFindInRow(char *s, long long len, char *query, int qlen)
+{
+    char *end = s + len - qlen;
+
+    if (qlen == 0)
+        return s;
+    for (char *p = s; p <= end; p++)
+    {
+        p = memchr(p, query[0], end - p + 1);
+        if (p == NULL)
+            return NULL;
+        if (!memcmp(p, query, qlen))
+            return p;
+    }
+    return NULL;
+}
 
 void editorFind(int fd)
 {
@@ -19,12 +27,10 @@ void editorFind(int fd)
     int qlen = 0;
     int last_match = -1;    /* Last line where a match was found. -1 for none. */
     int find_next = 0;      /* if 1 search next, if -1 search prev. */
-    int saved_hl_line = -1; /* No saved HL */
-    char *saved_hl = NULL;
 
     /* Save the cursor position in order to restore it later. */
-    int saved_cx = E.cx, saved_cy = E.cy;
-    int saved_coloff = E.coloff, saved_rowoff = E.rowoff;
+    int saved_cx = E.cx, saved_cy = E.cy, saved_rowoff = E.rowoff;
+    long long saved_coloff = E.coloff;
 
     while (1)
     {
@@ -48,7 +54,7 @@ void editorFind(int fd)
                 E.coloff = saved_coloff;
                 E.rowoff = saved_rowoff;
             }
-            FIND_RESTORE_HL;
+            E.findrow = -1;
             editorSetStatusMessage("");
             return;
         }
@@ -76,7 +82,7 @@ void editorFind(int fd)
         if (find_next)
         {
             char *match = NULL;
-            int match_offset = 0;
+            long long match_offset = 0;
             int i, current = last_match;
 
             for (i = 0; i < E.numrows; i++)
@@ -86,40 +92,41 @@ void editorFind(int fd)
                     current = E.numrows - 1;
                 else if (current == E.numrows)
                     current = 0;
-                match = strstr(E.row[current].render, query);
+                /* The content is searched, not the render: that needs no
+                 * render nor highlight, and nothing is left allocated for
+                 * the rows that don't match. Only the row of the match is
+                 * materialized, by editorRefreshScreen(). In memory budget
+                 * mode the rows searched are released as we go. */
+                editorRowsEvict();
+                erow *row = editorRowAt(current);
+                char *chars = editorRowChars(row);
+                match = editorFindInRow(chars, row->size, query, qlen);
                 if (match)
                 {
-                    match_offset = match - E.row[current].render;
+                    match_offset = editorRowCharToCol(row, match - chars);
                     break;
                 }
             }
             find_next = 0;
 
             /* Highlight */
-            FIND_RESTORE_HL;
+            E.findrow = -1;
 
             if (match)
             {
-                erow *row = &E.row[current];
                 last_match = current;
-                if (row->hl)
-                {
-                    saved_hl_line = current;
-                    saved_hl = malloc(row->rsize);
-                    memcpy(saved_hl, row->hl, row->rsize);
-                    memset(row->hl + match_offset, HL_MATCH, qlen);
-                }
                 E.cy = 0;
-                E.cx = match_offset;
                 E.rowoff = current;
-                E.coloff = 0;
                 /* Scroll horizontally as needed. */
-                if (E.cx > E.screencols)
-                {
-                    int diff = E.cx - E.screencols;
-                    E.cx -= diff;
-                    E.coloff += diff;
-                }
+                E.coloff = match_offset > E.screencols
+                               ? match_offset - E.screencols
+                               : 0;
+                E.cx = match_offset - E.coloff;
+                /* The match is drawn over the syntax highlight, see
+                 * editorRefreshScreen(). */
+                E.findrow = current;
+                E.findcol = match_offset;
+                E.findlen = qlen;
             }
         }
     }
@@ -0,0 +1,139 @@
+#include "kilo.h"
+#include "editor.h"
+
+/* Allocator for the render and highlight buffers of the rows. Those are
+ * many small buffers that are freed and allocated again all the time as
+ * rows are edited or evicted, so instead of going through malloc() every
+ * time they are carved out of big slabs, and kept in per size class free
+ * lists once freed. The size classes are multiples of 16 bytes up to 256,
+ * then powers of two up to KILO_SLAB_MAX. Bigger buffers are allocated one
+ * by one, but still tracked, so that everything can be released at once
+ * by editorSlabFreeAll() when the file is closed, without visiting rows. */
+
+#define SLAB_CLASSES (16 + 4) /* 16..256 by 16, then 512..KILO_SLAB_MAX. */
+
+struct slab
+{
+    struct slab *next;
+    char buf[];
+};
+
+struct bigAlloc
+{
+    struct bigAlloc *prev, *next;
+    char buf[];
+};
+
+static struct slab *slabs = NULL;          /* All the slabs. */
+static char *slabpos = NULL;               /* Free space in the last slab. */
+static size_t slabfree = 0;
+static void *freelist[SLAB_CLASSES];       /* Freed chunks of every class. */
+static struct bigAlloc *bigs = NULL;       /* Buffers too big for a class. */
+
+/* Return the size class of a buffer of 'size' bytes. */
+static int editorSlabClass(size_t size)
+{
+    if (size <= 256)
+        return size ? (size - 1) / 16 : 0;
+    int class = 16;
+    for (size_t csize = 512; csize < size; csize *= 2)
+        class++;
+    return class;
+}
+
+/* Return the size of the buffers of class 'class'. */
+static size_t editorSlabClassSize(int class)
+{
+    return class < 16 ? (size_t)(class + 1) * 16 : (size_t)512 << (class - 16);
+}
+
+static void *editorSlabOom(void *p)
+{
+    if (p == NULL)
+    {
+        perror("Out of memory");
+        exit(1);
+    }
+    return p;
+}
+
+/* Allocate a row buffer of 'size' bytes. */
+void *editorSlabAlloc(size_t size)
+{
+    if (size > KILO_SLAB_MAX)
+    {
+        struct bigAlloc *b = editorSlabOom(malloc(sizeof(*b) + size));
+        b->prev = NULL;
+        b->next = bigs;
+        if (bigs)
+            bigs->prev = b;
+        bigs = b;
+        return b->buf;
+    }
+
+    int class = editorSlabClass(size);
+    void *p = freelist[class];
+    if (p)
+    {
+        freelist[class] = *(void **)p;
+        return p;
+    }
+    size_t csize = editorSlabClassSize(class);
+    if (slabfree < csize)
+    {
+        /* The tail of the previous slab is lost, at most KILO_SLAB_MAX
+         * bytes every KILO_SLAB_SIZE. */
+        struct slab *s = editorSlabOom(malloc(sizeof(*s) + KILO_SLAB_SIZE));
+        s->next = slabs;
+        slabs = s;
+        slabpos = s->buf;
+        slabfree = KILO_SLAB_SIZE;
+    }
+    p = slabpos;
+    slabpos += csize;
+    slabfree -= csize;
+    return p;
+}
+
+/* Free a buffer returned by editorSlabAlloc(size). */
+void editorSlabFree(void *p, size_t size)
+{
+    if (p == NULL)
+        return;
+    if (size > KILO_SLAB_MAX)
+    {
+        struct bigAlloc *b = (struct bigAlloc *)((char *)p -
+                                                 offsetof(struct bigAlloc, buf));
+        if (b->prev)
+            b->prev->next = b->next;
+        else
+            bigs = b->next;
+        if (b->next)
+            b->next->prev = b->prev;
+        free(b);
+        return;
+    }
+    int class = editorSlabClass(size);
+    *(void **)p = freelist[class];
+    freelist[class] = p;
+}
+
+/* Release all the row buffers at once. */
+void editorSlabFreeAll(void)
+{
+    while (slabs)
+    {
+        struct slab *next = slabs->next;
+        free(slabs);
+        slabs = next;
+    }
+    while (bigs)
+    {
+        struct bigAlloc *next = bigs->next;
+        free(bigs);
+        bigs = next;
+    }
+    slabpos = NULL;
+    slabfree = 0;
+    memset(freelist, 0, sizeof(freelist));
+}
@@ -1,6 +1,11 @@
 #include "kilo.h"
 #include "editor.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KILO_X86_SIMD
+#include <immintrin.h>
+#endif
+
 /* C / C++ */
 char *C_HL_extensions[] = {".c", ".h", ".cpp", ".hpp", ".cc", NULL};
 char *C_HL_keywords[] = {
@@ -36,187 +41,963 @@ int is_separator(int c)
     return c == '\0' || isspace(c) || strchr(",.()+-/*=~%[];", c) != NULL;
 }
 
-/* Return true if the specified row last char is part of a multi line comment
- * that starts at this row or at one before, and does not end at the end
- * of the row but spawns to the next row. */
-int editorRowHasOpenComment(erow *row)
+/* The keywords of the current syntax, compiled into a perfect hash table by
+ * editorSyntaxCompile(): every keyword has a slot of its own, so that
+ * looking up a word costs one hash and one memcmp(), whatever the number of
+ * keywords. A keyword is only highlighted as a whole word, that is up to
+ * the next separator, so that is what is looked up. */
+struct keyword
 {
-    if (row->hl && row->rsize && row->hl[row->rsize - 1] == HL_MLCOMMENT &&
-        (row->rsize < 2 || (row->render[row->rsize - 2] != '*' ||
-                            row->render[row->rsize - 1] != '/')))
-        return 1;
+    char *s;
+    int len;
+    int hl; /* HL_KEYWORD1, or HL_KEYWORD2 for the ones ending with '|'. */
+};
+
+static struct
+{
+    struct editorSyntax *syntax; /* Syntax the table was compiled for. */
+    struct keyword *kw;
+    int n;
+    int maxlen;                  /* Longer words are no keyword. */
+    unsigned int seed;
+    unsigned int mask;           /* Slots minus one, a power of two. */
+    short *slot;                 /* Index in 'kw', or -1 for no keyword. */
+} K;
+
+static unsigned int editorKeywordHash(char *s, int len, unsigned int seed)
+{
+    unsigned int h = seed;
+    for (int j = 0; j < len; j++)
+        h = (h ^ (unsigned char)s[j]) * 16777619; /* FNV-1a. */
+    return h;
+}
+
+/* Return the keyword 's' of length 'len', or NULL if it is not one. */
+static struct keyword *editorKeywordFind(char *s, int len)
+{
+    if (len == 0 || len > K.maxlen)
+        return NULL;
+    int j = K.slot[editorKeywordHash(s, len, K.seed) & K.mask];
+    if (j == -1 || K.kw[j].len != len || memcmp(K.kw[j].s, s, len))
+        return NULL;
+    return K.kw + j;
+}
+
+/* Compile the keywords of 'syntax' into the hash table: seeds are tried
+ * until one puts every keyword in a slot of its own, doubling the table
+ * every few failures. With four slots per keyword or more it takes a
+ * handful of tries. A keyword listed twice keeps its first type, like
+ * when they were looked up in order. */
+static void editorKeywordsCompile(struct editorSyntax *syntax)
+{
+    char **keywords = syntax->keywords;
+    unsigned int size = 64;
+    int n = 0, j;
+
+    free(K.kw);
+    free(K.slot);
+    K.syntax = syntax;
+    K.n = K.maxlen = 0;
+    while (keywords && keywords[n])
+        n++;
+    K.kw = malloc(sizeof(struct keyword) * (n ? n : 1));
+    if (K.kw == NULL)
+    {
+        perror("Out of memory");
+        exit(1);
+    }
+    for (j = 0; j < n; j++)
+    {
+        int len = strlen(keywords[j]);
+        int kw2 = len && keywords[j][len - 1] == '|';
+        struct keyword kw = {keywords[j], len - kw2,
+                             kw2 ? HL_KEYWORD2 : HL_KEYWORD1};
+        int dup = 0;
+        for (int k = 0; k < K.n && !dup; k++)
+            dup = K.kw[k].len == kw.len && !memcmp(K.kw[k].s, kw.s, kw.len);
+        if (dup || kw.len == 0)
+            continue;
+        K.kw[K.n++] = kw;
+        if (kw.len > K.maxlen)
+            K.maxlen = kw.len;
+    }
+    while (size < (unsigned int)K.n * 4)
+        size *= 2;
+    for (K.seed = 2166136261u;; K.seed++)
+    {
+        if ((K.seed & 15) == 0)
+            size *= 2;
+        free(K.slot);
+        K.slot = malloc(sizeof(short) * size);
+        if (K.slot == NULL)
+        {
+            perror("Out of memory");
+            exit(1);
+        }
+        K.mask = size - 1;
+        memset(K.slot, -1, sizeof(short) * size);
+        for (j = 0; j < K.n; j++)
+        {
+            short *slot = K.slot + (editorKeywordHash(K.kw[j].s, K.kw[j].len,
+                                                      K.seed) & K.mask);
+            if (*slot != -1)
+                break;
+            *slot = j;
+        }
+        if (j == K.n)
+            break;
+    }
+}
+
+/* The highlighter is a state machine, run by editorUpdateSyntax() with one
+ * lookup per character in a table of moves indexed by the current state and
+ * the class of the character. The characters are split into classes once
+ * per syntax, from everything the rules below look at: two characters of
+ * the same class are always highlighted the same way. The states and the
+ * moves are found by editorMachineCompile() applying the rules to one
+ * character of every class, from the states a row can start with, until no
+ * new state shows up.
+ *
+ * The rules only know about the character at hand and, for the comment
+ * delimiters and the escapes in strings, the one after it. So when a
+ * character may start such a pair, the machine doesn't decide its type
+ * yet: the state remembers it, and the move on the next character sets
+ * the types of both. Keywords are only found once the word they may be
+ * ends, with editorKeywordFind(). */
+struct hlState
+{
+    unsigned int lead : 1; /* Still in the leading spaces of the row. */
+    unsigned int sep : 1;  /* The previous character was a separator. */
+    unsigned int num : 1;  /* The previous character was HL_NUMBER. */
+    unsigned int word : 1; /* In a word that may be a keyword. */
+    unsigned int lc : 1;   /* In a single line comment. */
+    unsigned int ml : 1;   /* In a multi line comment. */
+    unsigned int str : 8;  /* Quote of the string we are in, or 0. */
+    unsigned int pend : 9; /* Class + 1 of the character waiting, or 0. */
+};
+
+struct hlMove
+{
+    unsigned int next;    /* First move of the next state. */
+    unsigned char hl;     /* Type of the character. */
+    unsigned char prev;   /* Type of the previous one, for MOVE_PREV. */
+    unsigned char flags;
+};
+
+#define MOVE_PREV (1 << 0)       /* The previous character waited. */
+#define MOVE_WORD_START (1 << 1) /* A word that may be a keyword starts. */
+#define MOVE_WORD_END (1 << 2)   /* It ended just before this character. */
+#define MOVE_LINE_COMMENT (1 << 3) /* The rest of the row is HL_COMMENT. */
+#define MOVE_SKIP (1 << 4)       /* To a state with an hlSkip, see below. */
+
+/* In some states almost every byte leaves the machine in the same state,
+ * with the same type: inside comments and strings, only the delimiters
+ * matter. There the next byte that does something is found comparing many
+ * bytes at once, see editorSyntaxSkip(), and the type of the ones before
+ * it is set in bulk. */
+#define HL_SKIP_MAX 4
+
+struct hlSkip
+{
+    int n;                          /* Bytes that matter, 0 if too many. */
+    unsigned char stop[HL_SKIP_MAX];
+    unsigned char hl;               /* Type of all the other bytes. */
+};
+
+static struct
+{
+    unsigned char class[256];
+    unsigned char rep[256];  /* A character of every class. */
+    int nclass;
+    struct hlState *state;
+    int nstate;
+    struct hlMove *move;     /* 'nclass' moves for every state. */
+    unsigned char *fin;      /* Type of the character waiting at the end. */
+    struct hlSkip *skip;     /* Every state can have one. */
+    int avx2;                /* The CPU has AVX2, see editorSyntaxSkip(). */
+    int gen;                 /* Times compiled, see struct rowCols. */
+} M;
+
+/* True if 'c' may be part of a keyword: a word with any other character
+ * is not looked up. Keywords are expected to be made of characters without
+ * a rule of their own, like letters, digits and underscores. */
+static int editorMachineWordChar(int c)
+{
+    struct editorSyntax *syn = K.syntax;
+
+    if (!isprint(c) || is_separator(c) || c == '"' || c == '\'' ||
+        c == '\\' || c == (unsigned char)syn->singleline_comment_start[0] ||
+        c == (unsigned char)syn->multiline_comment_start[0] ||
+        c == (unsigned char)syn->multiline_comment_end[0])
+        return 0;
+    for (int j = 0; j < K.n; j++)
+        if (memchr(K.kw[j].s, c, K.kw[j].len))
+            return 1;
     return 0;
 }
 
-/* Set every byte of row->hl (that corresponds to every character in the line)
- * to the right syntax highlight type (HL_* defines). */
-void editorUpdateSyntax(erow *row)
+/* Apply the highlight rules to the character 'c' followed by 'next' (-1 at
+ * the end of the row) in state 's', setting the type of 'c' in 'hl[0]'.
+ * Returns 2 if 'next' made a pair with 'c', and its type is in 'hl[1]', or
+ * 1. These are the rules kilo always had, in the same order. */
+static int editorMachineRule(struct hlState *s, int c, int next,
+                             unsigned char *hl)
 {
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
+    struct editorSyntax *syn = K.syntax;
+    unsigned char *scs = (unsigned char *)syn->singleline_comment_start;
+    unsigned char *mcs = (unsigned char *)syn->multiline_comment_start;
+    unsigned char *mce = (unsigned char *)syn->multiline_comment_end;
+    int num = s->num;
 
-    if (E.syntax == NULL)
-        return; /* No syntax, everything is HL_NORMAL. */
+    if (s->lc)
+    {
+        hl[0] = HL_COMMENT;
+        return 1;
+    }
+    if (s->lead && isspace(c))
+    {
+        hl[0] = HL_NORMAL;
+        return 1;
+    }
+    s->lead = 0;
+    s->num = 0;
 
-    int i, prev_sep, in_string, in_comment;
-    char *p;
-    char **keywords = E.syntax->keywords;
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
+    /* Handle // comments. */
+    if (s->sep && c == scs[0] && next == scs[1])
+    {
+        hl[0] = hl[1] = HL_COMMENT;
+        s->lc = 1;
+        return 2;
+    }
 
-    /* Point to the first non-space char. */
-    p = row->render;
-    i = 0; /* Current char offset */
-    while (*p && isspace(*p))
+    /* Handle multi line comments. */
+    if (s->ml)
     {
-        p++;
-        i++;
+        hl[0] = HL_MLCOMMENT;
+        if (c == mce[0] && next == mce[1])
+        {
+            hl[1] = HL_MLCOMMENT;
+            s->ml = 0;
+            s->sep = 1;
+            return 2;
+        }
+        s->sep = 0;
+        return 1;
+    }
+    else if (c == mcs[0] && next == mcs[1])
+    {
+        hl[0] = hl[1] = HL_MLCOMMENT;
+        s->ml = 1;
+        s->sep = 0;
+        return 2;
     }
-    prev_sep = 1;   /* Tell the parser if 'i' points to start of word. */
-    in_string = 0;  /* Are we inside "" or '' ? */
-    in_comment = 0; /* Are we inside multi-line comment? */
 
-    /* If the previous line has an open comment, this line starts
-     * with an open comment state. */
-    if (row->idx > 0 && editorRowHasOpenComment(&E.row[row->idx - 1]))
-        in_comment = 1;
+    /* Handle "" and '' */
+    if (s->str)
+    {
+        hl[0] = HL_STRING;
+        if (c == '\\' && next != -1)
+        {
+            hl[1] = HL_STRING;
+            s->sep = 0;
+            return 2;
+        }
+        if (c == s->str)
+            s->str = 0;
+        return 1;
+    }
+    if (c == '"' || c == '\'')
+    {
+        hl[0] = HL_STRING;
+        s->str = c;
+        s->sep = 0;
+        return 1;
+    }
 
-    while (*p)
+    /* Handle non printable chars. */
+    if (!isprint(c))
     {
-        /* Handle // comments. */
-        if (prev_sep && *p == scs[0] && *(p + 1) == scs[1])
+        hl[0] = HL_NONPRINT;
+        s->sep = 0;
+        return 1;
+    }
+
+    /* Handle numbers */
+    if ((isdigit(c) && (s->sep || num)) || (c == '.' && num))
+    {
+        hl[0] = HL_NUMBER;
+        s->num = 1;
+        s->sep = 0;
+        return 1;
+    }
+
+    /* Keywords are looked up once the word ends. */
+    if (s->sep && editorMachineWordChar(c))
+        s->word = 1;
+    hl[0] = HL_NORMAL;
+    s->sep = is_separator(c);
+    return 1;
+}
+
+/* Return true if 'c' may start a pair of characters in state 's', so that
+ * its type depends on the character after it. */
+static int editorMachinePairs(struct hlState *s, int c)
+{
+    struct editorSyntax *syn = K.syntax;
+
+    if (s->lc || (s->lead && isspace(c)))
+        return 0;
+    return (s->sep && c == (unsigned char)syn->singleline_comment_start[0]) ||
+           (s->ml && c == (unsigned char)syn->multiline_comment_end[0]) ||
+           (!s->ml && c == (unsigned char)syn->multiline_comment_start[0]) ||
+           (!s->ml && s->str && c == '\\');
+}
+
+/* Return the index of state 's', adding it if it is a new one. */
+static int editorMachineState(struct hlState s)
+{
+    int j;
+
+    for (j = 0; j < M.nstate; j++)
+        if (!memcmp(M.state + j, &s, sizeof(s)))
+            return j;
+    M.state = realloc(M.state, sizeof(s) * (M.nstate + 1));
+    M.move = realloc(M.move, sizeof(struct hlMove) * M.nclass *
+                                 (M.nstate + 1));
+    M.fin = realloc(M.fin, M.nstate + 1);
+    M.skip = realloc(M.skip, sizeof(struct hlSkip) * (M.nstate + 1));
+    if (M.state == NULL || M.move == NULL || M.fin == NULL || M.skip == NULL)
+    {
+        perror("Out of memory");
+        exit(1);
+    }
+    M.state[M.nstate] = s;
+    return M.nstate++;
+}
+
+/* Find the move from state 'from' on a character of class 'class'. */
+static void editorMachineMove(int from, int class)
+{
+    struct hlState s = M.state[from];
+    struct hlMove m = {0, HL_NORMAL, HL_NORMAL, 0};
+    unsigned char hl[2];
+    int c = M.rep[class];
+
+    if (s.pend)
+    {
+        /* Now the type of the character that waited can be found. */
+        int n = editorMachineRule(&s, M.rep[s.pend - 1], c, hl);
+        s.pend = 0;
+        m.prev = hl[0];
+        m.flags |= MOVE_PREV;
+        if (n == 2)
         {
-            /* From here to end is a comment */
-            memset(row->hl + i, HL_COMMENT, row->size - i);
+            m.hl = hl[1];
+            if (s.lc)
+                m.flags |= MOVE_LINE_COMMENT;
+            m.next = editorMachineState(s) * M.nclass;
+            M.move[from * M.nclass + class] = m;
             return;
         }
+    }
+    if (s.word && is_separator(c))
+        m.flags |= MOVE_WORD_END;
+    if (s.word && !editorMachineWordChar(c))
+        s.word = 0;
+    if (editorMachinePairs(&s, c))
+    {
+        s.pend = class + 1;
+    }
+    else
+    {
+        int word = s.word;
+        editorMachineRule(&s, c, -1, hl);
+        m.hl = hl[0];
+        if (s.word && !word)
+            m.flags |= MOVE_WORD_START;
+    }
+    m.next = editorMachineState(s) * M.nclass;
+    M.move[from * M.nclass + class] = m;
+}
+
+/* True if 'c' is part of a comment delimiter. */
+static int editorMachineDelimiter(int c)
+{
+    struct editorSyntax *syn = K.syntax;
+
+    return memchr(syn->singleline_comment_start, c, 2) ||
+           memchr(syn->multiline_comment_start, c, 2) ||
+           memchr(syn->multiline_comment_end, c, 2);
+}
+
+/* Build the state machine for the current syntax. The start states are
+ * the first two: a row after one that doesn't end inside a comment, and
+ * after one that does. */
+static void editorMachineCompile(void)
+{
+    struct hlState start = {0};
+    int c, j, k;
 
-        /* Handle multi line comments. */
-        if (in_comment)
+    /* Characters go in the same class if no rule tells them apart. */
+    M.nclass = 0;
+    for (c = 0; c < 256; c++)
+    {
+        for (k = 0; k < M.nclass; k++)
         {
-            row->hl[i] = HL_MLCOMMENT;
-            if (*p == mce[0] && *(p + 1) == mce[1])
-            {
-                row->hl[i + 1] = HL_MLCOMMENT;
-                p += 2;
-                i += 2;
-                in_comment = 0;
-                prev_sep = 1;
-                continue;
-            }
-            else
-            {
-                prev_sep = 0;
-                p++;
-                i++;
-                continue;
-            }
+            int r = M.rep[k];
+            if (!!isspace(c) == !!isspace(r) && !!isprint(c) == !!isprint(r) &&
+                !!isdigit(c) == !!isdigit(r) &&
+                is_separator(c) == is_separator(r) &&
+                editorMachineWordChar(c) == editorMachineWordChar(r) &&
+                c != '.' && r != '.' && c != '"' && r != '"' &&
+                c != '\'' && r != '\'' && c != '\\' && r != '\\' &&
+                !editorMachineDelimiter(c) && !editorMachineDelimiter(r))
+                break;
         }
-        else if (*p == mcs[0] && *(p + 1) == mcs[1])
+        if (k == M.nclass)
+            M.rep[M.nclass++] = c;
+        M.class[c] = k;
+    }
+    /* Tabs are rendered as spaces, and a space is highlighted the same way
+     * however many follow it: giving tabs the class of spaces lets the
+     * machine run on the content of a row as well as on its render. That
+     * is how the open comment state of long rows is found, see
+     * editorSyntaxRowOpenComment(). */
+    M.class[TAB] = M.class[' '];
+
+    M.nstate = 0;
+    start.lead = start.sep = 1;
+    editorMachineState(start);
+    start.ml = 1;
+    editorMachineState(start);
+    for (j = 0; j < M.nstate; j++)
+    {
+        for (k = 0; k < M.nclass; k++)
+            editorMachineMove(j, k);
+        M.fin[j] = HL_NORMAL;
+        if (M.state[j].pend)
         {
-            row->hl[i] = HL_MLCOMMENT;
-            row->hl[i + 1] = HL_MLCOMMENT;
-            p += 2;
-            i += 2;
-            in_comment = 1;
-            prev_sep = 0;
-            continue;
+            struct hlState s = M.state[j];
+            unsigned char hl[2];
+            editorMachineRule(&s, M.rep[s.pend - 1], -1, hl);
+            M.fin[j] = hl[0];
         }
+    }
 
-        /* Handle "" and '' */
-        if (in_string)
+    /* Find the states worth skipping through, and the moves to them. */
+    for (j = 0; j < M.nstate; j++)
+    {
+        struct hlSkip *sk = M.skip + j;
+        struct hlMove *move = M.move + j * M.nclass;
+        sk->n = 0;
+        sk->hl = HL_NORMAL;
+        for (k = 0; k < M.nclass; k++)
         {
-            row->hl[i] = HL_STRING;
-            if (*p == '\\')
+            if (move[k].next == (unsigned int)j * M.nclass &&
+                move[k].flags == 0)
             {
-                row->hl[i + 1] = HL_STRING;
-                p += 2;
-                i += 2;
-                prev_sep = 0;
-                continue;
+                sk->hl = move[k].hl;
+                break;
             }
-            if (*p == in_string)
-                in_string = 0;
-            p++;
-            i++;
-            continue;
         }
-        else
+        for (c = 0; c < 256 && sk->n <= HL_SKIP_MAX; c++)
         {
-            if (*p == '"' || *p == '\'')
-            {
-                in_string = *p;
-                row->hl[i] = HL_STRING;
-                p++;
-                i++;
-                prev_sep = 0;
+            struct hlMove *m = move + M.class[c];
+            if (m->next == (unsigned int)j * M.nclass && m->flags == 0 &&
+                m->hl == sk->hl)
                 continue;
-            }
+            if (sk->n < HL_SKIP_MAX)
+                sk->stop[sk->n] = c;
+            sk->n++;
         }
+        if (sk->n > HL_SKIP_MAX)
+            sk->n = 0;
+    }
+    for (k = 0; k < M.nstate * M.nclass; k++)
+        if (M.skip[M.move[k].next / M.nclass].n)
+            M.move[k].flags |= MOVE_SKIP;
+#ifdef KILO_X86_SIMD
+    M.avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+/* Return how many bytes of 'p' can be skipped in a state with 'sk', that
+ * is the offset of the first of its stop bytes, or 'len'. */
+static long long editorSyntaxSkipScalar(unsigned char *p, long long len,
+                                        struct hlSkip *sk)
+{
+    long long i = 0;
+
+    if (sk->n == 1)
+    {
+        unsigned char *stop = memchr(p, sk->stop[0], len);
+        return stop ? stop - p : len;
+    }
+    while (i < len && !memchr(sk->stop, p[i], sk->n))
+        i++;
+    return i;
+}
 
-        /* Handle non printable chars. */
-        if (!isprint(*p))
+#ifdef KILO_X86_SIMD
+/* Compare 16 bytes at a time with every stop byte. Unused stop bytes are
+ * copies of the first one. */
+static long long editorSyntaxSkipSSE2(unsigned char *p, long long len,
+                                      struct hlSkip *sk)
+{
+    __m128i s[HL_SKIP_MAX];
+    long long i = 0;
+
+    for (int j = 0; j < HL_SKIP_MAX; j++)
+        s[j] = _mm_set1_epi8(sk->stop[j < sk->n ? j : 0]);
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, s[0]), _mm_cmpeq_epi8(v, s[1])),
+            _mm_or_si128(_mm_cmpeq_epi8(v, s[2]), _mm_cmpeq_epi8(v, s[3])));
+        uint32_t mask = _mm_movemask_epi8(eq);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + editorSyntaxSkipScalar(p + i, len - i, sk);
+}
+
+/* Same as above using 32 byte vectors, only called when the CPU has AVX2. */
+__attribute__((target("avx2"))) static long long
+editorSyntaxSkipAVX2(unsigned char *p, long long len, struct hlSkip *sk)
+{
+    __m256i s[HL_SKIP_MAX];
+    long long i = 0;
+
+    for (int j = 0; j < HL_SKIP_MAX; j++)
+        s[j] = _mm256_set1_epi8(sk->stop[j < sk->n ? j : 0]);
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i eq = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, s[0]),
+                            _mm256_cmpeq_epi8(v, s[1])),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, s[2]),
+                            _mm256_cmpeq_epi8(v, s[3])));
+        uint32_t mask = _mm256_movemask_epi8(eq);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + editorSyntaxSkipScalar(p + i, len - i, sk);
+}
+#endif
+
+/* Find the next of the stop bytes of 'sk' in 'p', with the widest vector
+ * unit available. */
+static long long editorSyntaxSkip(unsigned char *p, long long len,
+                                  struct hlSkip *sk)
+{
+#ifdef KILO_X86_SIMD
+    if (M.avx2)
+        return editorSyntaxSkipAVX2(p, len, sk);
+    return editorSyntaxSkipSSE2(p, len, sk);
+#else
+    return editorSyntaxSkipScalar(p, len, sk);
+#endif
+}
+
+/* Compile the keywords and the state machine of 'syntax'. */
+static void editorSyntaxCompile(struct editorSyntax *syntax)
+{
+    editorKeywordsCompile(syntax);
+    editorMachineCompile();
+    M.gen++;
+}
+
+/* Return true if the specified row last char is part of a multi line comment
+ * that starts at this row or at one before, and does not end at the end
+ * of the row but spawns to the next row. */
+static int editorRowHasOpenComment(erow *row, unsigned char *hl)
+{
+    if (row->rsize && hl[row->rsize - 1] == HL_MLCOMMENT &&
+        (row->rsize < 2 || (row->render[row->rsize - 2] != '*' ||
+                            row->render[row->rsize - 1] != '/')))
+        return 1;
+    return 0;
+}
+
+/* Release the highlight runs of a row. */
+void editorSyntaxFree(erow *row)
+{
+    E.rowmem -= row->nhl * sizeof(hlspan);
+    if (row->nhl)
+        editorSlabFree(row->hl, row->nhl * sizeof(hlspan));
+    row->hl = NULL;
+    row->nhl = 0;
+    row->flags &= ~ROW_HL;
+}
+
+#define HLSPAN_MAX_SKIP 4095
+#define HLSPAN_MAX_LEN 65535
+
+/* Store the highlight 'hl', one byte per rendered character, in the row as
+ * runs of the same type, leaving out the HL_NORMAL ones. The runs are
+ * collected in a buffer reused for all the rows, then copied. */
+static void editorSyntaxStore(erow *row, unsigned char *hl)
+{
+    static hlspan *spans = NULL;
+    static int cap = 0;
+    long long i, j, skip = 0;
+    int n = 0;
+
+    editorSyntaxFree(row);
+    for (i = 0; i < row->rsize; i = j)
+    {
+        /* Runs are often long: compare 8 bytes at a time first. */
+        uint64_t run = 0x0101010101010101ULL * hl[i], w;
+        for (j = i + 1; j + 8 <= row->rsize; j += 8)
         {
-            row->hl[i] = HL_NONPRINT;
-            p++;
-            i++;
-            prev_sep = 0;
-            continue;
+            memcpy(&w, hl + j, 8);
+            if (w != run)
+                break;
         }
-
-        /* Handle numbers */
-        if ((isdigit(*p) && (prev_sep || row->hl[i - 1] == HL_NUMBER)) ||
-            (*p == '.' && i > 0 && row->hl[i - 1] == HL_NUMBER))
+        for (; j < row->rsize && hl[j] == hl[i]; j++);
+        if (hl[i] == HL_NORMAL)
         {
-            row->hl[i] = HL_NUMBER;
-            p++;
-            i++;
-            prev_sep = 0;
+            skip += j - i;
             continue;
         }
-
-        /* Handle keywords and lib calls */
-        if (prev_sep)
+        for (long long len = j - i; len; n++)
         {
-            int j;
-            for (j = 0; keywords[j]; j++)
+            hlspan span = {0, 0, hl[i]};
+            if (skip > HLSPAN_MAX_SKIP)
             {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen - 1] == '|';
-                if (kw2)
-                    klen--;
-
-                if (!memcmp(p, keywords[j], klen) &&
-                    is_separator(*(p + klen)))
-                {
-                    /* Keyword */
-                    memset(row->hl + i, kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    p += klen;
-                    i += klen;
-                    break;
-                }
+                /* An empty run, just to skip that much. */
+                span.skip = HLSPAN_MAX_SKIP;
+                span.hl = HL_NORMAL;
+                skip -= HLSPAN_MAX_SKIP;
+            }
+            else
+            {
+                span.skip = skip;
+                span.len = len > HLSPAN_MAX_LEN ? HLSPAN_MAX_LEN : len;
+                skip = 0;
+                len -= span.len;
             }
-            if (keywords[j] != NULL)
+            if (n == cap)
             {
-                prev_sep = 0;
-                continue; /* We had a keyword match */
+                cap = cap ? cap * 2 : 256;
+                spans = realloc(spans, sizeof(hlspan) * cap);
+                if (spans == NULL)
+                {
+                    perror("Out of memory");
+                    exit(1);
+                }
             }
+            spans[n] = span;
         }
+    }
+    if (n == 0)
+        return;
+    row->hl = editorSlabAlloc(n * sizeof(hlspan));
+    memcpy(row->hl, spans, n * sizeof(hlspan));
+    row->nhl = n;
+    E.rowmem += n * sizeof(hlspan);
+}
 
-        /* Not special chars */
-        prev_sep = is_separator(*p);
-        p++;
-        i++;
+/* Highlight the word from 'start' to 'end' of the render, if a keyword. */
+static void editorSyntaxKeyword(erow *row, unsigned char *hl, long long start,
+                                long long end)
+{
+    /* A word starting before the window of a long row, at -1, is not
+     * looked up: only its end is rendered. */
+    struct keyword *kw = start >= 0 && end - start <= K.maxlen
+                             ? editorKeywordFind(row->render + start,
+                                                 end - start)
+                             : NULL;
+    if (kw)
+        memset(hl + start, kw->hl, end - start);
+}
+
+/* The open comment state at the end of some text, found running the
+ * machine like editorUpdateSyntax() does, but only keeping the type of the
+ * last character, so that the text can be fed in pieces. The tables are
+ * only read, they were compiled when the syntax was selected, so that the
+ * highlight thread can do this too. */
+struct hlScan
+{
+    unsigned int state;    /* First move of the current state. */
+    int hl;                /* Type of the last character. */
+    int lc;                /* A // comment started: the state is known. */
+    long long len;         /* Bytes scanned so far... */
+    unsigned char last[2]; /* ...and the last two of them. */
+};
+
+/* State of the machine once a // comment started: the rest of the row is
+ * HL_COMMENT, see editorSyntaxWindowState(). */
+#define HL_STATE_LC UINT_MAX
+
+/* Start scanning in the state 'state', the state of the machine or
+ * HL_STATE_LC. */
+static void editorSyntaxScanFrom(struct hlScan *sc, unsigned int state)
+{
+    sc->state = state == HL_STATE_LC ? 0 : state;
+    sc->hl = HL_NORMAL;
+    sc->lc = state == HL_STATE_LC;
+    sc->len = 0;
+}
+
+static void editorSyntaxScanStart(struct hlScan *sc, int ic)
+{
+    editorSyntaxScanFrom(sc, ic ? M.nclass : 0);
+}
+
+/* Scan the 'len' bytes at 'p', which follow the ones already scanned. */
+static void editorSyntaxScan(struct hlScan *sc, unsigned char *p,
+                             long long len)
+{
+    unsigned char *class = M.class;
+    struct hlMove *move = M.move;
+    unsigned int state = sc->state;
+    int hl = sc->hl;
+    long long i;
+
+    if (sc->lc || len == 0)
+        return;
+    for (i = 0; i < len; i++)
+    {
+        struct hlMove *m = move + state + class[p[i]];
+        hl = m->hl;
+        state = m->next;
+        if (m->flags & MOVE_LINE_COMMENT)
+        {
+            sc->lc = 1;
+            return;
+        }
+        if (m->flags & MOVE_SKIP)
+        {
+            struct hlSkip *sk = M.skip + state / M.nclass;
+            long long n = editorSyntaxSkip(p + i + 1, len - i - 1, sk);
+            if (n)
+                hl = sk->hl;
+            i += n;
+        }
+    }
+    sc->state = state;
+    sc->hl = hl;
+    sc->last[0] = len > 1 ? p[len - 2] : sc->last[1];
+    sc->last[1] = p[len - 1];
+    sc->len += len;
+}
+
+/* Scan the content of 'row' from offset 'from' to offset 'to', following
+ * the ones already scanned. */
+static void editorSyntaxScanRow(struct hlScan *sc, erow *row, long long from,
+                                long long to)
+{
+    struct iovec span[2];
+    int n = editorRowSpans(row, span);
+    long long off = 0;
+
+    for (int j = 0; j < n; off += span[j++].iov_len)
+    {
+        long long start = from > off ? from : off;
+        long long end = off + (long long)span[j].iov_len;
+        if (end > to)
+            end = to;
+        if (start < end)
+            editorSyntaxScan(sc, (unsigned char *)span[j].iov_base +
+                                     (start - off),
+                             end - start);
+    }
+}
+
+/* Return the state of the machine where the rendered window of a long row
+ * starts, for a row starting inside a comment if 'ic', or HL_STATE_LC: the
+ * content before it is scanned from the start of its chunk, whose state is
+ * kept in the column index of the row with the ones of the chunks before
+ * it, until the content changes, see struct rowChunk. So scrolling through
+ * the row only scans each chunk once. */
+static unsigned int editorSyntaxWindowState(erow *row, int ic)
+{
+    struct rowCols *c = row->cols;
+    long long k = c->wstart / KILO_ROW_CHUNK;
+    int key = M.gen * 2 + ic;
+    struct hlScan sc;
+
+    if (c->hlkey != key || c->hlvalid == 0)
+    {
+        c->chunk[0].state = ic ? M.nclass : 0;
+        c->hlvalid = 1;
+        c->hlkey = key;
+    }
+    for (long long j = c->hlvalid - 1; j < k; j++)
+    {
+        editorSyntaxScanFrom(&sc, c->chunk[j].state);
+        editorSyntaxScanRow(&sc, row, j * KILO_ROW_CHUNK,
+                            (j + 1) * KILO_ROW_CHUNK);
+        c->chunk[j + 1].state = sc.lc ? HL_STATE_LC : sc.state;
+        c->hlvalid = j + 2;
+    }
+    editorSyntaxScanFrom(&sc, c->chunk[k].state);
+    editorSyntaxScanRow(&sc, row, k * KILO_ROW_CHUNK, c->wstart);
+    return sc.lc ? HL_STATE_LC : sc.state;
+}
+
+/* Return the open comment state at the end of what was scanned. */
+static int editorSyntaxScanEnd(struct hlScan *sc)
+{
+    int hl = sc->hl;
+
+    if (sc->lc || sc->len == 0)
+        return 0;
+    if (M.state[sc->state / M.nclass].pend)
+        hl = M.fin[sc->state / M.nclass];
+    return hl == HL_MLCOMMENT &&
+           (sc->len < 2 || sc->last[0] != '*' || sc->last[1] != '/');
+}
+
+/* Return the open comment state at the end of the render 'render' of 'len'
+ * bytes, or of the content of a row, for a row starting inside a comment
+ * if 'ic': what editorUpdateSyntax() sets in hl_oc, but only following the
+ * type of the last character. */
+int editorSyntaxOpenComment(char *render, long long len, int ic)
+{
+    struct hlScan sc;
+
+    editorSyntaxScanStart(&sc, ic);
+    editorSyntaxScan(&sc, (unsigned char *)render, len);
+    return editorSyntaxScanEnd(&sc);
+}
+
+/* Return the open comment state at the end of a long row, whose render and
+ * highlight only cover a window: the whole content is scanned, so that a
+ * comment opened or closed out of the window still counts for the rows
+ * after it. The result is kept in the column index of the row until its
+ * content changes, so that scrolling through the row doesn't scan it
+ * again. */
+static int editorSyntaxRowOpenComment(erow *row, int ic)
+{
+    struct rowCols *c = row->cols;
+    struct hlScan sc;
+
+    if (c->oc[ic] != -1)
+        return c->oc[ic];
+    editorSyntaxScanStart(&sc, ic);
+    editorSyntaxScanRow(&sc, row, 0, row->size);
+    c->oc[ic] = editorSyntaxScanEnd(&sc);
+    return c->oc[ic];
+}
+
+/* Compute the syntax highlight type (HL_* defines) of every character of
+ * the render of a row, and store it in row->hl. The open comment state of
+ * the previous row must be up to date, see editorRowsSettle(). The types
+ * are first computed one byte per character, in a buffer reused for all
+ * the rows. */
+void editorUpdateSyntax(erow *row)
+{
+    static unsigned char *hl = NULL;
+    static long long hlcap = 0;
+
+    row->flags &= ~ROW_HL_IC;
+    row->hl_oc = 0;
+    if (E.syntax == NULL)
+    {
+        /* No syntax, everything is HL_NORMAL. */
+        editorSyntaxFree(row);
+        row->flags |= ROW_HL;
+        return;
+    }
+    if (hlcap < row->rsize)
+    {
+        hlcap = row->rsize * 2;
+        free(hl);
+        hl = malloc(hlcap);
+        if (hl == NULL)
+        {
+            perror("Out of memory");
+            exit(1);
+        }
+    }
+    if (K.syntax != E.syntax)
+        editorSyntaxCompile(E.syntax);
+
+    /* If the previous line has an open comment, this line starts
+     * with an open comment state. */
+    erow *prev = editorRowPrev(row);
+    unsigned int state = 0;
+    if (prev && prev->hl_oc)
+    {
+        state = M.nclass;
+        row->flags |= ROW_HL_IC;
+    }
+
+    /* Only a window of long rows is rendered: the machine starts in the
+     * state the content before it leaves. */
+    long long i = 0, word = 0;
+    if (row->flags & ROW_WINDOW)
+    {
+        state = editorSyntaxWindowState(row, (row->flags & ROW_HL_IC) != 0);
+        if (state == HL_STATE_LC)
+        {
+            /* A // comment started before the window. */
+            memset(hl, HL_COMMENT, row->rsize);
+            state = 0;
+            i = row->rsize;
+        }
+        else if (M.state[state / M.nclass].word)
+        {
+            word = -1;
+        }
+    }
+
+    /* The render is not null terminated, and the machine never looks past
+     * the character at hand. */
+    unsigned char *p = (unsigned char *)row->render, *class = M.class;
+    struct hlMove *move = M.move;
+    for (; i < row->rsize; i++)
+    {
+        struct hlMove *m = move + state + class[p[i]];
+        hl[i] = m->hl;
+        state = m->next;
+        if (m->flags == 0)
+            continue;
+        if (m->flags & MOVE_WORD_END)
+            editorSyntaxKeyword(row, hl, word, i);
+        /* Out of the window of a long row if it starts there. */
+        if ((m->flags & MOVE_PREV) && i > 0)
+            hl[i - 1] = m->prev;
+        if (m->flags & MOVE_WORD_START)
+            word = i;
+        if (m->flags & MOVE_LINE_COMMENT)
+        {
+            /* From here to end is a comment */
+            memset(hl + i, HL_COMMENT, row->rsize - i);
+            break;
+        }
+        if (m->flags & MOVE_SKIP)
+        {
+            struct hlSkip *sk = M.skip + state / M.nclass;
+            long long n = editorSyntaxSkip(p + i + 1, row->rsize - i - 1, sk);
+            memset(hl + i + 1, sk->hl, n);
+            i += n;
+        }
+    }
+    state /= M.nclass;
+    if (i == row->rsize && row->rsize)
+    {
+        if (M.state[state].pend)
+            hl[i - 1] = M.fin[state];
+        if (M.state[state].word)
+            editorSyntaxKeyword(row, hl, word, i);
     }
 
-    /* Propagate syntax change to the next row if the open commen
-     * state changed. This may recursively affect all the following rows
-     * in the file. */
-    int oc = editorRowHasOpenComment(row);
-    if (row->hl_oc != oc && row->idx + 1 < E.numrows)
-        editorUpdateSyntax(&E.row[row->idx + 1]);
-    row->hl_oc = oc;
+    /* The following rows are not updated here if the open comment state
+     * changed: they notice it once they are materialized again. Only a
+     * window of long rows is highlighted, so their state comes from the
+     * whole content instead. */
+    if (row->flags & ROW_WINDOW)
+        row->hl_oc = editorSyntaxRowOpenComment(row,
+                                                (row->flags & ROW_HL_IC) != 0);
+    else
+        row->hl_oc = editorRowHasOpenComment(row, hl);
+    editorSyntaxStore(row, hl);
+    row->flags |= ROW_HL;
 }
 
 /* Maps syntax highlight token types to terminal colors. */
@@ -258,7 +1039,10 @@ void editorSelectSyntaxHighlight(char *filename)
             {
                 if (s->filematch[i][0] != '.' || p[patlen] == '\0')
                 {
+                    /* The highlight thread reads the tables. */
+                    editorHighlightCancel();
                     E.syntax = s;
+                    editorSyntaxCompile(s);
                     return;
                 }
             }
@@ -68,8 +68,24 @@ int editorReadKey(int fd)
 {
     int nread;
     char c, seq[3];
-    while ((nread = read(fd, &c, 1)) == 0)
-        ;
+    while (1)
+    {
+        /* While a file loads rows are added between keys, not just when
+         * the read times out, see editorLoadPoll(): without waiting while
+         * some are ready to add, and only briefly while the loader thread
+         * looks for more. The same goes for a followed file being read. */
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int following = editorFollowProgress() != -1;
+        int loading = following || editorLoadProgress() != -1;
+        int timeout = following || editorLoadPending() ? 0 : 1;
+        if (!loading || poll(&pfd, 1, timeout) > 0)
+        {
+            if ((nread = read(fd, &c, 1)) != 0)
+                break;
+        }
+        if (editorPoll())
+            editorRefreshScreen();
+    }
     if (nread == -1)
         exit(1);
 
@@ -0,0 +1,74 @@
+/* Cost of a structural edit as the file grows: a row inserted and deleted
+ * again in the middle of the screen, which is then redrawn, for files of
+ * 10000 rows and ten times more every step up to 'rows'. Without row
+ * indices to renumber it should not depend on the size of the file; the
+ * array of rows kilo had before, see testOldInsertRow(), is timed along
+ * for comparison.
+ *
+ * Usage: bench_edit <rows> [edits] */
+#include "test.h"
+
+/* Materialize the rows on screen, like editorRefreshScreen() does. */
+static void drawScreen(void)
+{
+    erow *row = editorRowAt(E.rowoff);
+
+    for (int y = 0; y < E.screenrows && row; y++, row = editorRowNext(row))
+        editorRowMaterialize(row, E.rowoff + y);
+}
+
+int main(int argc, char **argv)
+{
+    static char text[] = "    for (int j = 0; j < n; j++) /* comment */";
+    struct iovec lines[KILO_INSERT_BATCH];
+    int rows, edits;
+
+    CHECK(argc >= 2);
+    rows = atoi(argv[1]);
+    edits = argc > 2 ? atoi(argv[2]) : 10000;
+    testInit("bench.c");
+    for (int j = 0; j < KILO_INSERT_BATCH; j++)
+    {
+        lines[j].iov_base = text;
+        lines[j].iov_len = sizeof(text) - 1;
+    }
+
+    printf("%10s %14s %14s\n", "rows", "array us/edit", "tree us/edit");
+    for (int n = 10000; n <= rows; n *= 10)
+    {
+        double t, old, new;
+
+        while (testOld.n < n)
+            testOldInsertRow(testOld.n, text, sizeof(text) - 1);
+        t = testNow();
+        for (int j = 0; j < edits; j++)
+        {
+            testOldInsertRow(n / 2, text, sizeof(text) - 1);
+            testOldDelRow(n / 2);
+        }
+        old = testNow() - t;
+
+        while (E.numrows < n)
+        {
+            int batch = n - E.numrows;
+            if (batch > KILO_INSERT_BATCH)
+                batch = KILO_INSERT_BATCH;
+            editorInsertRows(E.numrows, lines, batch);
+        }
+        E.rowoff = n / 2 - E.screenrows / 2;
+        drawScreen();
+        t = testNow();
+        for (int j = 0; j < edits; j++)
+        {
+            editorInsertRow(n / 2, text, sizeof(text) - 1);
+            drawScreen();
+            editorDelRow(n / 2);
+            drawScreen();
+        }
+        new = testNow() - t;
+        printf("%10d %14.3f %14.3f\n", n, old * 1e6 / edits,
+               new * 1e6 / edits);
+    }
+    testOldFree();
+    return 0;
+}
@@ -0,0 +1,77 @@
+/* Highlighting speed over a C corpus: editorUpdateSyntax() against the
+ * rules kilo had before, that tried every keyword in turn at every word,
+ * see testReferenceHl(). The corpus is made of the files given, repeated
+ * until it is 'megabytes' big.
+ *
+ * Usage: bench_highlight <megabytes> <file.c>... */
+#include "test.h"
+
+/* Append the rows of 'filename' to the editor. Returns the bytes added. */
+static long long loadRows(char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    long long bytes = 0;
+
+    CHECK(fp != NULL);
+    while ((len = getline(&line, &cap, fp)) != -1)
+    {
+        if (len && line[len - 1] == '\n')
+            len--;
+        editorInsertRow(E.numrows, line, len);
+        bytes += len + 1;
+    }
+    free(line);
+    fclose(fp);
+    return bytes;
+}
+
+int main(int argc, char **argv)
+{
+    long long want, bytes = 0;
+    unsigned char *hl = NULL;
+    long long cap = 0;
+    double t, tnew, told;
+
+    CHECK(argc >= 3);
+    want = atoll(argv[1]) * 1024 * 1024;
+    testInit("bench.c");
+    while (bytes < want)
+        for (int j = 2; j < argc; j++)
+            bytes += loadRows(argv[j]);
+    for (erow *row = editorRowAt(0); row; row = editorRowNext(row))
+    {
+        editorRowRender(row);
+        if (row->rsize > cap)
+        {
+            cap = row->rsize * 2;
+            free(hl);
+            hl = malloc(cap);
+            CHECK(hl != NULL);
+        }
+    }
+
+    /* The rows are highlighted in order, so every row starts with the
+     * open comment state of the one before it. */
+    t = testNow();
+    for (erow *row = editorRowAt(0); row; row = editorRowNext(row))
+        editorUpdateSyntax(row);
+    tnew = testNow() - t;
+
+    int ic = 0;
+    t = testNow();
+    for (erow *row = editorRowAt(0); row; row = editorRowNext(row))
+        ic = testReferenceHl(row->render, row->rsize, ic, hl);
+    told = testNow() - t;
+
+    printf("%d rows, %.1f MB\n", E.numrows, bytes / 1e6);
+    printf("keyword scan:  %8.1f ms %8.1f MB/s\n", told * 1e3,
+           bytes / told / 1e6);
+    printf("editor:        %8.1f ms %8.1f MB/s\n", tnew * 1e3,
+           bytes / tnew / 1e6);
+    printf("speedup:       %8.2fx\n", told / tnew);
+    free(hl);
+    return 0;
+}
@@ -0,0 +1,79 @@
+/* Newline indexing speed: editorIndexLines() and editorIndexLinesParallel()
+ * on the mapped file, against the getline() loop editorOpen() used to read
+ * it with, stripping the newline of every line. The file is a temporary one
+ * of 'megabytes' with lines of random length up to 'max line' bytes, read
+ * once before timing so that it is in the page cache for all of them.
+ *
+ * Usage: bench_index <megabytes> [max line] */
+#include "test.h"
+
+int main(int argc, char **argv)
+{
+    char path[] = "/tmp/kilo-bench-XXXXXX";
+    size_t len, lines = 0;
+    int maxline;
+    double t;
+
+    CHECK(argc >= 2);
+    len = (size_t)atoll(argv[1]) * 1024 * 1024;
+    maxline = argc > 2 ? atoi(argv[2]) : 80;
+    CHECK(maxline > 0);
+
+    char *buf = malloc(len);
+    CHECK(buf != NULL);
+    srand(1);
+    for (size_t j = 0; j < len; j++)
+        buf[j] = 'a' + j % 26;
+    for (size_t j = rand() % maxline; j < len; j += 1 + rand() % maxline)
+        buf[j] = '\n';
+    int fd = mkstemp(path);
+    CHECK(fd != -1);
+    unlink(path);
+    CHECK(write(fd, buf, len) == (ssize_t)len);
+    free(buf);
+    char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    CHECK(map != MAP_FAILED);
+    for (size_t j = 0; j < len; j += 4096)
+        lines += map[j] == '\n';
+
+    /* What editorOpen() did before the index. */
+    CHECK(lseek(fd, 0, SEEK_SET) == 0);
+    FILE *fp = fdopen(dup(fd), "r");
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    CHECK(fp != NULL);
+    lines = 0;
+    t = testNow();
+    while ((linelen = getline(&line, &linecap, fp)) != -1)
+    {
+        if (linelen &&
+            (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+            line[--linelen] = '\0';
+        lines++;
+    }
+    t = testNow() - t;
+    printf("getline:  %9zu lines %8.1f ms %6.2f GB/s\n", lines, t * 1e3,
+           len / t / 1e9);
+    free(line);
+    fclose(fp);
+
+    lineindex li = {0};
+    t = testNow();
+    editorIndexLines(&li, map, len, 0);
+    t = testNow() - t;
+    printf("index:    %9zu lines %8.1f ms %6.2f GB/s\n", li.count, t * 1e3,
+           len / t / 1e9);
+    editorFreeLineIndex(&li);
+
+    t = testNow();
+    editorIndexLinesParallel(&li, map, len, 0);
+    t = testNow() - t;
+    printf("parallel: %9zu lines %8.1f ms %6.2f GB/s\n", li.count, t * 1e3,
+           len / t / 1e9);
+    editorFreeLineIndex(&li);
+
+    munmap(map, len);
+    close(fd);
+    return 0;
+}
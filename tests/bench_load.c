@@ -0,0 +1,73 @@
+/* Loading speed: editorOpen() on a temporary file of 'megabytes' with lines
+ * of random length up to 'max line' bytes, then editorLoadPoll() until all
+ * the rows are added, like the main loop does while no key comes in. The
+ * time to the first frame is what editorOpen() itself takes, and the total
+ * is compared with editorIndexLinesParallel() alone on the same mapping,
+ * which is as fast as the loader can find the rows. The file is read once
+ * before timing so that it is in the page cache for all of them. Then the
+ * same in memory budget mode, with the bytes the rows take after each.
+ *
+ * Usage: bench_load <megabytes> [max line] */
+#include "test.h"
+
+int main(int argc, char **argv)
+{
+    char path[] = "/tmp/kilo-bench-XXXXXX";
+    size_t len, lines = 0;
+    int maxline;
+    double t, first;
+
+    CHECK(argc >= 2);
+    len = (size_t)atoll(argv[1]) * 1024 * 1024;
+    maxline = argc > 2 ? atoi(argv[2]) : 80;
+    CHECK(maxline > 0);
+
+    char *buf = malloc(len);
+    CHECK(buf != NULL);
+    srand(1);
+    for (size_t j = 0; j < len; j++)
+        buf[j] = 'a' + j % 26;
+    for (size_t j = rand() % maxline; j < len; j += 1 + rand() % maxline)
+        buf[j] = '\n';
+    int fd = mkstemp(path);
+    CHECK(fd != -1);
+    CHECK(write(fd, buf, len) == (ssize_t)len);
+    free(buf);
+    char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    CHECK(map != MAP_FAILED);
+    for (size_t j = 0; j < len; j += 4096)
+        lines += map[j] == '\n';
+
+    lineindex li = {0};
+    t = testNow();
+    editorIndexLinesParallel(&li, map, len, 0);
+    t = testNow() - t;
+    printf("index:  %9zu lines %8.1f ms %6.2f GB/s\n", li.count, t * 1e3,
+           len / t / 1e9);
+    lines = li.count + (map[len - 1] != '\n');
+    editorFreeLineIndex(&li);
+    munmap(map, len);
+    close(fd);
+
+    testInit(path);
+    for (int budget = 0; budget < 2; budget++)
+    {
+        E.membudget = budget ? 1024 * 1024 : 0;
+        t = testNow();
+        CHECK(editorOpen(path) == 0);
+        first = testNow() - t;
+        int firstrows = E.numrows;
+        while (editorLoadProgress() != -1)
+            editorLoadPoll();
+        t = testNow() - t;
+        CHECK((size_t)E.numrows == lines);
+        editorRowsEvict();
+        printf("%s\n", budget ? "budget 1 MB:" : "no budget:");
+        printf("first:  %9d lines %8.1f ms\n", firstrows, first * 1e3);
+        printf("load:   %9d lines %8.1f ms %6.2f GB/s %8.1f MB in rows\n",
+               E.numrows, t * 1e3, len / t / 1e9, E.rowmem / 1e6);
+        editorCloseFile();
+    }
+    unlink(path);
+    return 0;
+}
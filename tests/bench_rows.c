@@ -0,0 +1,133 @@
+/* Row storage speed and memory: the row API on the row tree and the piece
+ * table, against the array of rows kilo had before, see testOldInsertRow().
+ * Both load 'rows' random rows, then insert, delete and type in 'edits'
+ * random places, paste 'edits' rows in the middle at once and turn the
+ * rows into one string to save.
+ *
+ * Usage: bench_rows <rows> <edits> */
+#include "test.h"
+#include <malloc.h>
+
+static int nrows, nedits;
+static char line[64];
+
+/* Bytes of heap in use. */
+static size_t heapUsed(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+
+    return mi.uordblks + mi.hblkhd;
+}
+
+static int randomLine(void)
+{
+    int len = rand() % 60;
+
+    for (int j = 0; j < len; j++)
+        line[j] = 'a' + rand() % 26;
+    return len;
+}
+
+static void report(const char *what, double old, double new)
+{
+    printf("%-10s %10.1f ms %10.1f ms %8.1fx\n", what, old * 1e3, new * 1e3,
+           old / new);
+}
+
+int main(int argc, char **argv)
+{
+    double old[6], new[6], t;
+    size_t heap, oldmem, newmem, len;
+    char *buf;
+
+    CHECK(argc >= 3);
+    nrows = atoi(argv[1]);
+    nedits = atoi(argv[2]);
+    testInit("bench.txt");
+
+    /* The array of rows. */
+    srand(1);
+    heap = heapUsed();
+    t = testNow();
+    for (int j = 0; j < nrows; j++)
+        testOldInsertRow(testOld.n, line, randomLine());
+    old[0] = testNow() - t;
+    oldmem = heapUsed() - heap;
+    t = testNow();
+    for (int j = 0; j < nedits; j++)
+        testOldInsertRow(rand() % testOld.n, line, randomLine());
+    old[1] = testNow() - t;
+    t = testNow();
+    for (int j = 0; j < nedits; j++)
+        testOldDelRow(rand() % testOld.n);
+    old[2] = testNow() - t;
+    t = testNow();
+    for (int j = 0; j < nedits; j++)
+    {
+        int at = rand() % testOld.n;
+        testOldInsertChar(at, rand() % (testOld.row[at].size + 1), 'x');
+    }
+    old[3] = testNow() - t;
+    t = testNow();
+    for (int j = 0; j < nedits; j++)
+        testOldInsertRow(testOld.n / 2 + j, line, randomLine());
+    old[4] = testNow() - t;
+    t = testNow();
+    buf = testOldRowsToString(&len);
+    old[5] = testNow() - t;
+    free(buf);
+    testOldFree();
+
+    /* The row tree. A paste inserts all its rows at once. */
+    srand(1);
+    heap = heapUsed();
+    t = testNow();
+    for (int j = 0; j < nrows; j++)
+        editorInsertRow(E.numrows, line, randomLine());
+    new[0] = testNow() - t;
+    newmem = heapUsed() - heap;
+    t = testNow();
+    for (int j = 0; j < nedits; j++)
+        editorInsertRow(rand() % E.numrows, line, randomLine());
+    new[1] = testNow() - t;
+    t = testNow();
+    for (int j = 0; j < nedits; j++)
+        editorDelRow(rand() % E.numrows);
+    new[2] = testNow() - t;
+    t = testNow();
+    for (int j = 0; j < nedits; j++)
+    {
+        erow *row = editorRowAt(rand() % E.numrows);
+        editorRowInsertChar(row, rand() % (row->size + 1), 'x');
+    }
+    new[3] = testNow() - t;
+    struct iovec *paste = malloc(sizeof(struct iovec) * nedits);
+    char *text = malloc((size_t)nedits * sizeof(line));
+    CHECK(paste != NULL && text != NULL);
+    for (int j = 0; j < nedits; j++)
+    {
+        paste[j].iov_base = text + (size_t)j * sizeof(line);
+        paste[j].iov_len = randomLine();
+        memcpy(paste[j].iov_base, line, paste[j].iov_len);
+    }
+    t = testNow();
+    editorInsertRows(E.numrows / 2, paste, nedits);
+    new[4] = testNow() - t;
+    free(paste);
+    free(text);
+    t = testNow();
+    buf = editorRowsToString(&len);
+    new[5] = testNow() - t;
+    free(buf);
+
+    printf("%d rows, %d edits           array         tree\n", nrows, nedits);
+    report("load", old[0], new[0]);
+    report("insert", old[1], new[1]);
+    report("delete", old[2], new[2]);
+    report("type", old[3], new[3]);
+    report("paste", old[4], new[4]);
+    report("to string", old[5], new[5]);
+    printf("%-10s %10.1f MB %10.1f MB\n", "memory", oldmem / 1e6,
+           newmem / 1e6);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/* What an atomic save costs over a save in place: a file of 'megabytes' in
+ * 'dir' is saved whole 'runs' times each way, the second way with a hard
+ * link to it, which makes editorSave() rewrite it in place. The atomic save
+ * also flushes the file and its directory to disk, which the save in place
+ * never did. How long editorSave() itself blocks the main thread, before
+ * the save goes on in the background, is reported too, and what it blocks
+ * for after a single character is inserted a few megabytes into the file,
+ * which moves all the rows after it.
+ *
+ * Usage: bench_save <megabytes> <dir> [runs] */
+#include "test.h"
+
+static double start = 0; /* Total time spent in editorSave(). */
+
+static double timeSaves(int runs)
+{
+    double t = testNow();
+
+    for (int j = 0; j < runs; j++)
+    {
+        editorMarkRowDirty(0);
+        double s = testNow();
+        CHECK(editorSave() == 0);
+        start += testNow() - s;
+        editorSaveWait();
+        CHECK(strncmp(E.statusmsg, "Can't", 5) != 0);
+    }
+    return (testNow() - t) / runs;
+}
+
+int main(int argc, char **argv)
+{
+    char path[4096], linkpath[4096];
+    size_t len;
+    int runs;
+
+    CHECK(argc >= 3);
+    len = (size_t)atoll(argv[1]) * 1024 * 1024;
+    runs = argc > 3 ? atoi(argv[3]) : 5;
+    snprintf(path, sizeof(path), "%s/kilo-bench-save.txt", argv[2]);
+    snprintf(linkpath, sizeof(linkpath), "%s/kilo-bench-save.link",
+             argv[2]);
+
+    FILE *fp = fopen(path, "w");
+    CHECK(fp != NULL);
+    for (size_t j = 0; j < len; j += 64)
+        fprintf(fp, "%063zu\n", j);
+    fclose(fp);
+    testInit(path);
+    CHECK(editorOpen(path) == 0);
+    while (editorLoadProgress() != -1)
+        editorLoadPoll();
+
+    double atomic = timeSaves(runs);
+    unlink(linkpath);
+    CHECK(link(path, linkpath) == 0);
+    double inplace = timeSaves(runs);
+    unlink(linkpath);
+
+    /* Over the file as mapped, not one already replaced. */
+    editorCloseFile();
+    CHECK(editorOpen(path) == 0);
+    while (editorLoadProgress() != -1)
+        editorLoadPoll();
+    int at = 2 * KILO_SAVE_INCREMENTAL_MIN / 64;
+    if (at >= E.numrows)
+        at = E.numrows / 2;
+    editorRowInsertChar(editorRowAt(at), 0, 'x');
+    double edit = testNow();
+    CHECK(editorSave() == 0);
+    edit = testNow() - edit;
+    editorSaveWait();
+    CHECK(strncmp(E.statusmsg, "Can't", 5) != 0);
+    editorCloseFile();
+    unlink(path);
+
+    printf("in place: %8.1f ms %8.1f MB/s\n", inplace * 1e3,
+           len / inplace / 1e6);
+    printf("atomic:   %8.1f ms %8.1f MB/s\n", atomic * 1e3,
+           len / atomic / 1e6);
+    printf("cost:     %8.1f ms %8.2fx\n", (atomic - inplace) * 1e3,
+           atomic / inplace);
+    printf("start:    %8.1f ms\n", start / (2 * runs) * 1e3);
+    printf("edit:     %8.1f ms\n", edit * 1e3);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/* Golden input of the syntax highlight test: every rule of the C syntax,
+ * and the ways they meet. The expected types are in golden.c.hl. */
+#include <stdio.h>
+#include "kilo.h"
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+typedef struct point
+{
+	int x, y;	/* Tabs are expanded before highlighting. */
+	unsigned long long id;
+	const char *name;
+	double weight;
+} point;
+
+static int counter = 0; // Single line comment.
+int zero=0;//Not after a separator.
+int half = a/2; /* Division, then a comment. */
+
+enum color { RED = 1, GREEN = 0x2F, BLUE = 3.14159, ALPHA = 1e10 };
+
+/* A comment
+   going on for
+   three rows */ int after_comment = 42;
+
+/* Nested /* opening is ignored */ int x1 = 7;
+int y1 = 7;  /* closes */ /* reopens
+and stays open "with a string" 'c' 123 int
+until here */ return x1;
+
+char *s1 = "a string with \"escapes\" and /* no comment */";
+char *s2 = "unterminated string \
+continues only on this row";
+char c1 = '\'', c2 = '"', c3 = '\\';
+char *s3 = "// not a comment either";
+
+int f(int a, float b)
+{
+	if (a > 10 && b < 2.5f)
+		return sizeof(struct point);
+	else if (!a)
+		return -1;
+	for (int i = 0; i < a; i++) { continue; }
+	while (0) break;
+	switch (a) { case 1: default: goto out; }
+out:
+	return NULL == 0;
+}
+
+class Widget : public Base {
+public:
+	virtual ~Widget() noexcept = default;
+	template <typename T> static_assert(true, "ok");
+	bool flag = false; auto v = nullptr; thread_local int tl;
+	void *p = reinterpret_cast<void *>(this);
+	xor_eq or_eq not_eq and_eq bitand bitor compl
+};
+
+int1 intx _int int_ Int INT i.nt int(int)int;int
+autoauto auto|auto constexpr const_cast
+12abc abc12 1.2.3 .5 5. 0.0.0 a1.5 (1.5) -2 +3 x=4
+100000000000000000000 12345678901234567890
+/**/ int after_empty_comment;
+/*/ still a comment /*/ int after;
+*/ stray closer
+"/*" int not_a_comment_start;
+'/*' '*/'
+// /* a line comment hides an opener
+ // indented line comment
+	// tabbed line comment
+a // comment after a word
+a+// comment after a separator
+/* comment ending at the end of the row */
+/* comment opening at the end of the row /*
+still open */
+/*
+*/
+/* */
+x /*
+y */ z
+"string" "two" 'x' 'yy' '' ""
+"ends with backslash\
+'quote inside "double' "'single"
+`backtick` $dollar @at #hash ?q !bang ^caret &amp |pipe ~tilde
+ctrlchardel [0m "instring" /* incomment */
+end
@@ -0,0 +1,245 @@
+#include "test.h"
+
+/* Set up the editor like initEditor() does, but for a fixed size screen
+ * instead of the terminal, with the syntax of 'filename'. */
+void testInit(char *filename)
+{
+    E.cx = E.cy = E.rowoff = 0;
+    E.coloff = 0;
+    E.dirty = 0;
+    E.dirtyrow = -1;
+    E.hlfence = INT_MAX;
+    E.findrow = -1;
+    E.screenrows = 24;
+    E.screencols = 80;
+    editorSelectSyntaxHighlight(filename);
+}
+
+/* Seconds elapsed since some fixed time, for the benchmarks. */
+double testNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Expand the highlight runs of a materialized row into 'hl', one HL_* type
+ * per rendered character. */
+void testRowHl(erow *row, unsigned char *hl)
+{
+    long long i = 0;
+
+    memset(hl, HL_NORMAL, row->rsize);
+    for (int s = 0; s < row->nhl; s++)
+    {
+        i += row->hl[s].skip;
+        memset(hl + i, row->hl[s].hl, row->hl[s].len);
+        i += row->hl[s].len;
+    }
+}
+
+/* The highlight rules as editorUpdateSyntax() applied them before it was a
+ * state machine, one branch after the other and trying every keyword in
+ * turn, with the look aheads bound by the end of the render. Sets the type
+ * of every character of 'render' in 'hl', for a row starting inside a
+ * comment if 'ic', and returns the open comment state at the end. */
+int testReferenceHl(char *render, long long len, int ic, unsigned char *hl)
+{
+    char **keywords = E.syntax->keywords;
+    char *scs = E.syntax->singleline_comment_start;
+    char *mcs = E.syntax->multiline_comment_start;
+    char *mce = E.syntax->multiline_comment_end;
+    char *p = render, *end = render + len;
+    long long i = 0;
+    int prev_sep = 1, in_string = 0, in_comment = ic;
+
+    memset(hl, HL_NORMAL, len);
+    while (p < end && isspace(*p))
+    {
+        p++;
+        i++;
+    }
+    while (p < end)
+    {
+        if (prev_sep && p + 1 < end && *p == scs[0] && *(p + 1) == scs[1])
+        {
+            memset(hl + i, HL_COMMENT, len - i);
+            break;
+        }
+        if (in_comment)
+        {
+            hl[i] = HL_MLCOMMENT;
+            if (p + 1 < end && *p == mce[0] && *(p + 1) == mce[1])
+            {
+                hl[i + 1] = HL_MLCOMMENT;
+                p += 2;
+                i += 2;
+                in_comment = 0;
+                prev_sep = 1;
+            }
+            else
+            {
+                prev_sep = 0;
+                p++;
+                i++;
+            }
+            continue;
+        }
+        else if (p + 1 < end && *p == mcs[0] && *(p + 1) == mcs[1])
+        {
+            hl[i] = hl[i + 1] = HL_MLCOMMENT;
+            p += 2;
+            i += 2;
+            in_comment = 1;
+            prev_sep = 0;
+            continue;
+        }
+        if (in_string)
+        {
+            hl[i] = HL_STRING;
+            if (*p == '\\' && p + 1 < end)
+            {
+                hl[i + 1] = HL_STRING;
+                p += 2;
+                i += 2;
+                prev_sep = 0;
+                continue;
+            }
+            if (*p == in_string)
+                in_string = 0;
+            p++;
+            i++;
+            continue;
+        }
+        else if (*p == '"' || *p == '\'')
+        {
+            in_string = *p;
+            hl[i] = HL_STRING;
+            p++;
+            i++;
+            prev_sep = 0;
+            continue;
+        }
+        if (!isprint(*p))
+        {
+            hl[i] = HL_NONPRINT;
+            p++;
+            i++;
+            prev_sep = 0;
+            continue;
+        }
+        if ((isdigit(*p) && (prev_sep || hl[i - 1] == HL_NUMBER)) ||
+            (*p == '.' && i > 0 && hl[i - 1] == HL_NUMBER))
+        {
+            hl[i] = HL_NUMBER;
+            p++;
+            i++;
+            prev_sep = 0;
+            continue;
+        }
+        if (prev_sep)
+        {
+            int j;
+            for (j = 0; keywords[j]; j++)
+            {
+                int klen = strlen(keywords[j]);
+                int kw2 = keywords[j][klen - 1] == '|';
+                if (kw2)
+                    klen--;
+                if (klen <= end - p && !memcmp(p, keywords[j], klen) &&
+                    (p + klen == end || is_separator(p[klen])))
+                {
+                    memset(hl + i, kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+                    p += klen;
+                    i += klen;
+                    break;
+                }
+            }
+            if (keywords[j] != NULL)
+            {
+                prev_sep = 0;
+                continue;
+            }
+        }
+        prev_sep = is_separator(*p);
+        p++;
+        i++;
+    }
+    return len && hl[len - 1] == HL_MLCOMMENT &&
+           (len < 2 || render[len - 2] != '*' || render[len - 1] != '/');
+}
+
+/* The rows as kilo stored them before the row tree, for the benchmarks: an
+ * array of rows reallocated on every insert, every row with its own
+ * malloc()ed content and its index, renumbered on inserts and deletes. The
+ * render and highlight that were computed along are left out. */
+struct testOldRows testOld = {NULL, 0};
+
+void testOldInsertRow(int at, char *s, size_t len)
+{
+    struct testOldRow *row;
+
+    testOld.row = realloc(testOld.row,
+                          sizeof(struct testOldRow) * (testOld.n + 1));
+    CHECK(testOld.row != NULL);
+    memmove(testOld.row + at + 1, testOld.row + at,
+            sizeof(struct testOldRow) * (testOld.n - at));
+    for (int j = at + 1; j <= testOld.n; j++)
+        testOld.row[j].idx++;
+    row = testOld.row + at;
+    row->idx = at;
+    row->size = len;
+    row->chars = malloc(len + 1);
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+    testOld.n++;
+}
+
+void testOldDelRow(int at)
+{
+    free(testOld.row[at].chars);
+    memmove(testOld.row + at, testOld.row + at + 1,
+            sizeof(struct testOldRow) * (testOld.n - at - 1));
+    for (int j = at; j < testOld.n - 1; j++)
+        testOld.row[j].idx--;
+    testOld.n--;
+}
+
+void testOldInsertChar(int at, int col, int c)
+{
+    struct testOldRow *row = testOld.row + at;
+
+    row->chars = realloc(row->chars, row->size + 2);
+    memmove(row->chars + col + 1, row->chars + col, row->size - col + 1);
+    row->chars[col] = c;
+    row->size++;
+}
+
+char *testOldRowsToString(size_t *buflen)
+{
+    size_t len = 0;
+    char *buf, *p;
+
+    for (int j = 0; j < testOld.n; j++)
+        len += testOld.row[j].size + 1;
+    *buflen = len;
+    p = buf = malloc(len + 1);
+    for (int j = 0; j < testOld.n; j++)
+    {
+        memcpy(p, testOld.row[j].chars, testOld.row[j].size);
+        p += testOld.row[j].size;
+        *p++ = '\n';
+    }
+    *p = '\0';
+    return buf;
+}
+
+void testOldFree(void)
+{
+    for (int j = 0; j < testOld.n; j++)
+        free(testOld.row[j].chars);
+    free(testOld.row);
+    testOld.row = NULL;
+    testOld.n = 0;
+}
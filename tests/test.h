@@ -0,0 +1,44 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "kilo.h"
+#include "editor.h"
+
+/* Stop the test with a message if 'cond' is false. */
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,          \
+                    __LINE__, #cond);                                       \
+            exit(1);                                                        \
+        }                                                                   \
+    } while (0)
+
+struct testOldRow
+{
+    int idx;
+    int size;
+    char *chars;
+};
+
+struct testOldRows
+{
+    struct testOldRow *row;
+    int n;
+};
+
+extern struct testOldRows testOld;
+
+void testInit(char *filename);
+double testNow(void);
+void testRowHl(erow *row, unsigned char *hl);
+int testReferenceHl(char *render, long long len, int ic, unsigned char *hl);
+void testOldInsertRow(int at, char *s, size_t len);
+void testOldDelRow(int at);
+void testOldInsertChar(int at, int col, int c);
+char *testOldRowsToString(size_t *buflen);
+void testOldFree(void);
+
+#endif /* TEST_H */
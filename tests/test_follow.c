@@ -0,0 +1,97 @@
+/* Follow mode must end up with the rows of everything written to the file,
+ * in order, whatever way it is written: a file bigger than a batch already
+ * there when kilo starts, lines appended, a line written in pieces, the
+ * file truncated and the file rotated.
+ *
+ * Usage: test_follow <dir> */
+#include "test.h"
+
+static char path[4096], oldpath[4096];
+static char *want = NULL;
+static size_t wantlen = 0;
+
+/* Append 'len' bytes to the file open as 'fd', and to what the rows should
+ * hold. */
+static void writeFile(int fd, char *s, size_t len)
+{
+    CHECK(write(fd, s, len) == (ssize_t)len);
+    want = realloc(want, wantlen + len);
+    CHECK(want != NULL);
+    memcpy(want + wantlen, s, len);
+    wantlen += len;
+}
+
+/* Let follow mode catch up with the file, and compare the rows with what
+ * was written. */
+static void checkRows(const char *what)
+{
+    size_t len;
+
+    editorFollowPoll();
+    while (editorFollowProgress() != -1)
+        editorFollowPoll();
+    char *rows = editorRowsToString(&len);
+    int partial = wantlen && want[wantlen - 1] != '\n';
+    if (len != wantlen + partial || memcmp(rows, want, wantlen))
+    {
+        fprintf(stderr, "%s: %zu bytes in the rows, %zu expected\n", what,
+                len, wantlen + partial);
+        exit(1);
+    }
+    free(rows);
+}
+
+int main(int argc, char **argv)
+{
+    char line[64];
+
+    CHECK(argc >= 2);
+    snprintf(path, sizeof(path), "%s/kilo-test-follow.log", argv[1]);
+    snprintf(oldpath, sizeof(oldpath), "%s/kilo-test-follow.log.1",
+             argv[1]);
+    unlink(oldpath);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd != -1);
+    for (int j = 0; j < KILO_FOLLOW_BATCH / 16; j++)
+        writeFile(fd, line, snprintf(line, sizeof(line), "old %11d\n", j));
+
+    /* Nothing is read before the first frame. */
+    testInit(path);
+    E.follow = 1;
+    CHECK(editorOpen(path) == 0);
+    CHECK(E.numrows == 0);
+    CHECK(editorFollowProgress() != -1);
+    checkRows("existing content");
+    CHECK(E.dirty == 0);
+
+    writeFile(fd, "one\ntwo\n", 8);
+    checkRows("append");
+    writeFile(fd, "par", 3);
+    checkRows("partial line");
+    writeFile(fd, "tial\nnext", 9);
+    checkRows("line completed");
+    writeFile(fd, "\n", 1);
+
+    CHECK(ftruncate(fd, 0) == 0);
+    CHECK(lseek(fd, 0, SEEK_SET) == 0);
+    writeFile(fd, "after truncate\n", 15);
+    checkRows("truncate");
+
+    /* Rotated while there are lines not read from the old file yet. */
+    writeFile(fd, "last of the old file\n", 21);
+    CHECK(rename(path, oldpath) == 0);
+    close(fd);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd != -1);
+    writeFile(fd, "rotated\n", 8);
+    checkRows("rotate");
+    writeFile(fd, "more\n", 5);
+    checkRows("append after rotate");
+    CHECK(E.dirty == 0);
+
+    close(fd);
+    unlink(path);
+    unlink(oldpath);
+    free(want);
+    return 0;
+}
@@ -0,0 +1,369 @@
+/* The open comment state the highlight thread finds must leave every row
+ * highlighted like a highlight from scratch would, whatever the edits,
+ * screen refreshes and thread results in between.
+ *
+ * Usage: test_highlight [iterations] [seed] [memory budget in bytes] */
+#include "test.h"
+
+/* Highlight the whole file from scratch with the reference rules, and
+ * compare every row with it, materializing them in a random order. */
+static void checkAll(void)
+{
+    int n = E.numrows, *oc = malloc(sizeof(int) * (n + 1));
+    unsigned char got[1024], want[1024];
+
+    oc[0] = 0;
+    for (int at = 0; at < n; at++)
+    {
+        erow *row = editorRowAt(at);
+        editorRowRender(row);
+        CHECK(row->rsize <= (long long)sizeof(want));
+        oc[at + 1] = testReferenceHl(row->render, row->rsize, oc[at], want);
+    }
+    for (int k = 0; k < 20 && n; k++)
+    {
+        int at = rand() % n;
+        erow *row = editorRowAt(at);
+        editorRowMaterialize(row, at);
+        testReferenceHl(row->render, row->rsize, oc[at], want);
+        testRowHl(row, got);
+        if (row->hl_oc != oc[at + 1] || memcmp(got, want, row->rsize))
+        {
+            fprintf(stderr, "row %d \"%.*s\" highlighted wrong\n", at,
+                    (int)row->size, editorRowChars(row));
+            exit(1);
+        }
+    }
+    free(oc);
+}
+
+static void setRow(int at, char *s)
+{
+    erow *row = editorRowAt(at);
+
+    editorRowTruncate(row, 0);
+    editorRowAppendString(row, s, strlen(s));
+}
+
+/* A row highlighted on screen, whose hl_oc the thread then changes, must
+ * not be taken as still highlighted right once the rows before it change
+ * back. */
+static void checkPublished(void)
+{
+    char *rows[] = {"a", "b", "c", "d"};
+
+    for (int j = 0; j < 4; j++)
+        editorInsertRow(j, rows[j], 1);
+    for (int j = 0; j < 4; j++)
+        editorRowMaterialize(editorRowAt(j), j);
+
+    /* Opening a comment on the first row puts the others in it... */
+    setRow(0, "/*");
+    editorHighlightPoll();
+    editorHighlightWait();
+    /* ...and out of it again, without being on screen in between. */
+    setRow(0, "a");
+    erow *last = editorRowAt(3);
+    editorRowMaterialize(last, 3);
+    CHECK(last->hl_oc == 0);
+    CHECK(last->nhl == 0);
+    checkAll();
+    while (E.numrows)
+        editorDelRow(0);
+}
+
+/* Only a window of a long row is highlighted, but a comment it opens or
+ * closes out of the window must still count for the rows after it, both
+ * when the screen settles the rows and when the thread does. */
+static void checkLongRow(void)
+{
+    long long len = KILO_ROW_LONG + 100;
+    char *s = malloc(len);
+
+    memset(s, 'a', len);
+    s[1] = TAB;
+    memcpy(s + len - 2, "/*", 2);
+    editorInsertRow(0, s, len);
+    editorInsertRow(1, "b", 1);
+    E.coloff = 0;
+    editorRowMaterialize(editorRowAt(0), 0);
+    CHECK(editorRowAt(0)->flags & ROW_WINDOW);
+    editorRowMaterialize(editorRowAt(1), 1);
+    CHECK(editorRowAt(1)->hl_oc == 1);
+
+    /* Closing the comment out of the window. */
+    editorRowAppendString(editorRowAt(0), "*/", 2);
+    editorRowMaterialize(editorRowAt(1), 1);
+    CHECK(editorRowAt(1)->hl_oc == 0);
+
+    /* The same through the thread, with a row before it that opens a
+     * comment the long row closes. */
+    memcpy(s + len - 2, "*/", 2);
+    editorInsertRow(0, "/*", 2);
+    editorRowTruncate(editorRowAt(1), 0);
+    editorRowAppendString(editorRowAt(1), s, len);
+    editorHighlightPoll();
+    editorHighlightWait();
+    CHECK(editorRowAt(1)->hl_oc == 0);
+    editorRowMaterialize(editorRowAt(2), 2);
+    CHECK(editorRowAt(2)->hl_oc == 0);
+    while (E.numrows)
+        editorDelRow(0);
+    free(s);
+}
+
+/* The window of a long row is highlighted like the same columns of the
+ * whole row would be: inside a comment or a string opened at the start of
+ * the row, or after a // comment, and out of a comment closed before the
+ * window, scrolling back and forth, and after an edit before the window. */
+static void checkLongRowWindow(void)
+{
+    char *starts[] = {"/*", "\"", "//", "/* */", "x"};
+    long long len = KILO_ROW_LONG + 4 * KILO_ROW_CHUNK;
+    long long coloffs[] = {300000, 100000, 300000};
+    char *s = malloc(len), *filler = "ab 12 cd ";
+    unsigned char *want = malloc(len), got[2 * KILO_ROW_WINDOW];
+
+    for (int j = 0; j < 5; j++)
+    {
+        for (long long k = 0; k < len; k++)
+            s[k] = filler[k % 9];
+        memcpy(s, starts[j], strlen(starts[j]));
+        editorInsertRow(0, s, len);
+        for (int c = 0; c < 4; c++)
+        {
+            if (c == 3)
+            {
+                /* Inside the comment the window was in, out of it. */
+                editorRowInsertChar(editorRowAt(0), 2, '*');
+                editorRowInsertChar(editorRowAt(0), 3, '/');
+                memmove(s + 4, s + 2, len - 4);
+                memcpy(s + 2, "*/", 2);
+            }
+            testReferenceHl(s, len, 0, want);
+            E.coloff = coloffs[c % 3];
+            erow *row = editorRowAt(0);
+            editorRowMaterialize(row, 0);
+            CHECK(row->flags & ROW_WINDOW);
+            CHECK(row->rsize <= (long long)sizeof(got));
+            testRowHl(row, got);
+            if (memcmp(got, want + row->cols->wstart, row->rsize))
+            {
+                fprintf(stderr, "window at %lld after \"%s\" highlighted "
+                                "wrong\n", E.coloff, starts[j]);
+                exit(1);
+            }
+        }
+        editorDelRow(0);
+    }
+    E.coloff = 0;
+    free(s);
+    free(want);
+}
+
+static void randomRow(char *buf, int *len)
+{
+    static char *pieces[] = {"/*", "*/", "a", " ", "\t", "//", "\"", "int",
+                             "1", "*", "/"};
+
+    *len = 0;
+    for (int n = rand() % 6; n; n--)
+    {
+        char *s = pieces[rand() % 11];
+        memcpy(buf + *len, s, strlen(s));
+        *len += strlen(s);
+    }
+}
+
+/* Open the file 'path' of 'n' lines, each "b" except the one at 'open',
+ * "/\*", in memory budget mode. */
+static void openLines(char *path, int n, int open)
+{
+    FILE *fp = fopen(path, "w");
+
+    CHECK(fp != NULL);
+    for (int j = 0; j < n; j++)
+        fputs(j == open ? "/*\n" : "b\n", fp);
+    fclose(fp);
+    editorCloseFile();
+    CHECK(editorOpen(path) == 0);
+    while (editorLoadProgress() != -1)
+        editorLoadPoll();
+}
+
+/* Rows dropped in memory budget mode must come back with the open comment
+ * state they had, and still flagged stale if it may be out of date: here
+ * the rows after a deleted "/\*" are all still known to be in a comment,
+ * but the first of them only is flagged, see editorRowsSettle(). */
+static void checkUnloaded(void)
+{
+    char path[] = "/tmp/kilo-test-hl-XXXXXX";
+    size_t budget = E.membudget;
+
+    close(mkstemp(path));
+    E.membudget = 1;
+    openLines(path, 4 * KILO_TREE_LEAF, KILO_TREE_LEAF - 1);
+    editorRowsSettle(E.numrows, LLONG_MAX);
+    CHECK(editorRowAt(2 * KILO_TREE_LEAF)->hl_oc == 1);
+    editorDelRow(KILO_TREE_LEAF - 1);
+    E.rowoff = E.numrows - E.screenrows;
+    editorRowsEvict();
+    CHECK(E.rowmem < 3 * KILO_TREE_LEAF * sizeof(erow));
+    erow *row = editorRowAt(2 * KILO_TREE_LEAF);
+    editorRowMaterialize(row, 2 * KILO_TREE_LEAF);
+    CHECK(row->hl_oc == 0);
+    editorCloseFile();
+    unlink(path);
+    E.rowoff = 0;
+    E.membudget = budget;
+}
+
+/* In memory budget mode the highlight thread captures no more rows than a
+ * quarter of the budget holds, content included, give or take the leaf of
+ * the last one: here long lines not loaded yet. */
+static void checkCaptureBudget(void)
+{
+    char path[] = "/tmp/kilo-test-hl-XXXXXX", line[1024];
+    size_t budget = E.membudget;
+
+    close(mkstemp(path));
+    FILE *fp = fopen(path, "w");
+    CHECK(fp != NULL);
+    memset(line, 'a', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\n';
+    for (int j = 0; j < 4096; j++)
+        fwrite(line, 1, sizeof(line), fp);
+    fclose(fp);
+    E.membudget = 1024 * 1024;
+    editorCloseFile();
+    CHECK(editorOpen(path) == 0);
+    while (editorLoadProgress() != -1)
+        editorLoadPoll();
+    E.rowoff = E.numrows - E.screenrows;
+    editorHighlightPoll();
+    CHECK(E.rowmem <= E.membudget / 4 +
+                          KILO_TREE_LEAF * (sizeof(erow) + sizeof(line)));
+    editorHighlightWait();
+    CHECK(E.hlvalid > 0);
+    editorCloseFile();
+    unlink(path);
+    E.rowoff = 0;
+    E.membudget = budget;
+}
+
+/* A save in place, that the rows moved by an edit make write over the
+ * lines the highlight thread is going through, stops it without waiting
+ * for it, and the rows are then settled by the next jobs. */
+static void checkSaveInPlace(void)
+{
+    char path[] = "/tmp/kilo-test-hl-XXXXXX", linkpath[64];
+
+    close(mkstemp(path));
+    snprintf(linkpath, sizeof(linkpath), "%s.link", path);
+    openLines(path, 100000, -1);
+    CHECK(link(path, linkpath) == 0);
+    setRow(0, "/*");
+    editorHighlightPoll();
+    CHECK(editorSave() == 0);
+    editorSaveWait();
+    CHECK(strncmp(E.statusmsg, "Can't", 5) != 0);
+    while (E.hlvalid < E.numrows)
+    {
+        editorHighlightPoll();
+        editorHighlightWait();
+    }
+    CHECK(editorRowAt(E.numrows - 1)->hl_oc == 1);
+    checkAll();
+    editorCloseFile();
+    unlink(linkpath);
+    unlink(path);
+}
+
+/* Random edits, with the rows on screen materialized, the thread polled
+ * and waited for, and the rows settled in between. The rows are loaded
+ * from a file, so that in memory budget mode the ones not edited are
+ * dropped and made again from the mapping, like between frames. */
+static void checkRandom(int iterations)
+{
+    char buf[128], path[] = "/tmp/kilo-test-hl-XXXXXX";
+    int len, fd = mkstemp(path);
+
+    CHECK(fd != -1);
+    for (int j = 0; j < 3000; j++)
+    {
+        randomRow(buf, &len);
+        buf[len++] = '\n';
+        CHECK(write(fd, buf, len) == len);
+    }
+    close(fd);
+    editorCloseFile();
+    CHECK(editorOpen(path) == 0);
+    while (editorLoadProgress() != -1)
+        editorLoadPoll();
+    for (int it = 0; it < iterations; it++)
+    {
+        editorRowsEvict();
+        int at = rand() % E.numrows;
+        erow *row = editorRowAt(at);
+
+        switch (rand() % 10)
+        {
+        case 0:
+            editorRowInsertChar(row, rand() % (row->size + 1),
+                                "/*a\t"[rand() % 4]);
+            break;
+        case 1:
+            if (row->size)
+                editorRowDelChar(row, rand() % row->size);
+            break;
+        case 2:
+            randomRow(buf, &len);
+            editorInsertRow(at, buf, len);
+            break;
+        case 3:
+            if (E.numrows > 50)
+                editorDelRow(at);
+            break;
+        case 4:
+            editorRowTruncate(row, row->size / 2);
+            break;
+        case 5:
+            randomRow(buf, &len);
+            editorRowAppendString(row, buf, len);
+            break;
+        case 6:
+            E.rowoff = at;
+            for (int j = at; j < at + E.screenrows && j < E.numrows; j++)
+                editorRowMaterialize(editorRowAt(j), j);
+            break;
+        case 7:
+            editorHighlightPoll();
+            break;
+        case 8:
+            editorHighlightWait();
+            break;
+        case 9:
+            editorRowsSettle(at, rand() % 200);
+            break;
+        }
+        if (it % 100 == 0)
+            checkAll();
+    }
+    editorCloseFile();
+    unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+    testInit("test.c");
+    srand(argc > 2 ? atoi(argv[2]) : 1);
+    E.membudget = argc > 3 ? atol(argv[3]) : 0;
+    checkPublished();
+    checkLongRow();
+    checkLongRowWindow();
+    checkUnloaded();
+    checkSaveInPlace();
+    checkCaptureBudget();
+    checkRandom(argc > 1 ? atoi(argv[1]) : 20000);
+    return 0;
+}
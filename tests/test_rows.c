@@ -0,0 +1,259 @@
+/* The rows must hold exactly what was loaded and typed, in order: random
+ * edits on the row tree are mirrored on the array of rows kilo had before,
+ * see testOldInsertRow(), and editorRowsToString() must give the same
+ * string as testOldRowsToString(). Then files with newlines at the edges of
+ * the loader steps, with and without a final newline or '\r', must load as
+ * the rows the getline() loop used to read. Both again in memory budget
+ * mode, with the rows of a file dropped and made again all along.
+ *
+ * Usage: test_rows <dir> [iterations] [seed] */
+#include "test.h"
+
+static char line[64];
+
+static int randomLine(void)
+{
+    int len = rand() % 40;
+
+    for (int j = 0; j < len; j++)
+        line[j] = 'a' + rand() % 26;
+    return len;
+}
+
+/* Compare the rows with the old array: the file offsets the tree keeps
+ * track of first, before the rows are all loaded, then the rows as a whole
+ * and walking the tree. */
+static void checkRows(void)
+{
+    size_t len, want, off = 0;
+
+    for (int at = 0; at <= testOld.n; at++)
+    {
+        if (at % 97 == 0 || at == testOld.n)
+            CHECK(editorRowOffset(at) == off);
+        if (at < testOld.n)
+            off += testOld.row[at].size + 1;
+    }
+
+    char *rows = editorRowsToString(&len);
+    char *old = testOldRowsToString(&want);
+    CHECK(E.numrows == testOld.n);
+    CHECK(len == want && memcmp(rows, old, len) == 0);
+    free(rows);
+    free(old);
+
+    erow *row = editorRowAt(0);
+    for (int at = 0; at < E.numrows; at++, row = editorRowNext(row))
+    {
+        CHECK(row != NULL && editorRowIndex(row) == at);
+        CHECK(row == editorRowAt(at));
+    }
+    CHECK(row == NULL);
+    if (E.numrows)
+        CHECK(editorRowPrev(editorRowAt(0)) == NULL);
+}
+
+/* Random row inserts, deletes and edits, single and in bulk, enough for the
+ * tree to split and merge its leaves and nodes many times over, on the rows
+ * already there. In memory budget mode the rows not used lately are dropped
+ * before every edit, like between frames. */
+static void checkEdits(int iterations)
+{
+    struct iovec lines[3 * KILO_TREE_LEAF];
+    char buf[3 * KILO_TREE_LEAF * 40];
+
+    for (int it = 0; it < iterations; it++)
+    {
+        editorRowsEvict();
+        int at = E.numrows ? rand() % E.numrows : 0;
+        struct testOldRow *old = testOld.row + at;
+        erow *row = editorRowAt(at);
+        int len, n, op = E.numrows ? rand() % 7 : 0;
+
+        /* Enough rows for a tree of three levels, but not many more. */
+        if (E.numrows > 3 * KILO_TREE_LEAF * KILO_TREE_FANOUT && op < 2)
+            op = 2;
+        switch (op)
+        {
+        case 0:
+            len = randomLine();
+            editorInsertRow(at, line, len);
+            testOldInsertRow(at, line, len);
+            break;
+        case 1:
+            n = 1 + rand() % (3 * KILO_TREE_LEAF);
+            for (int j = 0, off = 0; j < n; j++, off += len)
+            {
+                len = randomLine();
+                memcpy(buf + off, line, len);
+                lines[j].iov_base = buf + off;
+                lines[j].iov_len = len;
+                testOldInsertRow(at + j, line, len);
+            }
+            editorInsertRows(at, lines, n);
+            break;
+        case 2:
+        case 3:
+            editorDelRow(at);
+            testOldDelRow(at);
+            break;
+        case 4:
+            len = rand() % (row->size + 1);
+            editorRowInsertChar(row, len, 'A' + rand() % 26);
+            testOldInsertChar(at, len, editorRowCharAt(row, len));
+            break;
+        case 5:
+            len = randomLine();
+            editorRowAppendString(row, line, len);
+            old->chars = realloc(old->chars, old->size + len + 1);
+            memcpy(old->chars + old->size, line, len);
+            old->size += len;
+            old->chars[old->size] = '\0';
+            break;
+        case 6:
+            len = row->size ? rand() % row->size : 0;
+            if (rand() % 2)
+            {
+                editorRowDelChar(row, len);
+                if (len < old->size)
+                {
+                    memmove(old->chars + len, old->chars + len + 1,
+                            old->size - len);
+                    old->size--;
+                }
+            }
+            else
+            {
+                editorRowTruncate(row, len);
+                old->size = len;
+                old->chars[len] = '\0';
+            }
+            break;
+        }
+        if (it % 500 == 0)
+            checkRows();
+    }
+    checkRows();
+    editorCloseFile();
+    testOldFree();
+}
+
+/* Write 'len' bytes to the file 'path', open it and wait for the loader,
+ * then compare the rows with what the getline() loop read: every line
+ * without its newline, and a last line without one stripped of a final
+ * '\r'. */
+static void checkLoad(char *path, char *buf, size_t len, const char *what)
+{
+    FILE *fp = fopen(path, "w");
+    size_t got;
+
+    CHECK(fp != NULL && fwrite(buf, 1, len, fp) == len);
+    fclose(fp);
+    CHECK(editorOpen(path) == 0);
+    while (editorLoadProgress() != -1)
+        editorLoadPoll();
+
+    size_t want = len;
+    char *expect = malloc(len + 1);
+    memcpy(expect, buf, len);
+    if (len && expect[len - 1] != '\n')
+    {
+        if (expect[len - 1] == '\r')
+            want--;
+        expect[want++] = '\n';
+    }
+    char *rows = editorRowsToString(&got);
+    if (got != want || memcmp(rows, expect, got))
+    {
+        fprintf(stderr, "%s: %zu bytes loaded, %zu expected\n", what, got,
+                want);
+        exit(1);
+    }
+    CHECK(E.dirty == 0);
+    free(rows);
+    free(expect);
+    editorCloseFile();
+}
+
+/* Random edits on a file loaded in memory budget mode, see checkEdits(). */
+static void checkBudget(char *dir, int iterations)
+{
+    char path[4096];
+    size_t len;
+
+    snprintf(path, sizeof(path), "%s/kilo-test-rows.txt", dir);
+    FILE *fp = fopen(path, "w");
+    CHECK(fp != NULL);
+    for (int j = 0; j < 20 * KILO_TREE_LEAF; j++)
+    {
+        len = randomLine();
+        fwrite(line, 1, len, fp);
+        fputc('\n', fp);
+        testOldInsertRow(j, line, len);
+    }
+    fclose(fp);
+    E.membudget = 1;
+    CHECK(editorOpen(path) == 0);
+    while (editorLoadProgress() != -1)
+        editorLoadPoll();
+    checkRows();
+    checkEdits(iterations);
+    E.membudget = 0;
+    unlink(path);
+}
+
+/* Newlines right before, at and after the end of the part indexed before
+ * the first frame and of the first loader steps, "\r\n" pairs across them,
+ * and every way the file can end. */
+static void checkLoader(char *dir)
+{
+    size_t len = 2 * KILO_INDEX_CHUNK + 4096;
+    size_t edges[] = {KILO_LOAD_FIRST, KILO_INDEX_CHUNK,
+                      2 * KILO_INDEX_CHUNK};
+    char *buf = malloc(len + 2);
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/kilo-test-rows.txt", dir);
+    for (size_t j = 0; j < len; j++)
+        buf[j] = 'a' + j % 26;
+    for (size_t j = rand() % 80; j < len; j += 1 + rand() % 80)
+        buf[j] = '\n';
+    for (int e = 0; e < 3; e++)
+    {
+        buf[edges[e] - 2] = '\r';
+        buf[edges[e] - 1] = '\n';
+        buf[edges[e]] = '\n';
+        buf[edges[e] + 1] = '\n';
+        buf[edges[e] + 3] = '\r';
+        buf[edges[e] + 4] = '\n';
+    }
+    buf[len - 1] = '\n';
+    checkLoad(path, buf, len, "final newline");
+    checkLoad(path, buf, len - 1, "no final newline");
+    buf[len - 1] = '\r';
+    checkLoad(path, buf, len, "final '\\r'");
+    buf[len - 2] = '\r';
+    buf[len - 1] = '\n';
+    checkLoad(path, buf, len, "final \"\\r\\n\"");
+    buf[len] = '\r';
+    checkLoad(path, buf, len + 1, "final '\\r' after a newline");
+    checkLoad(path, "\n", 1, "a single newline");
+    checkLoad(path, "\r", 1, "a single '\\r'");
+    checkLoad(path, "a", 1, "a single byte");
+    unlink(path);
+    free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    CHECK(argc >= 2);
+    srand(argc > 3 ? atoi(argv[3]) : 1);
+    testInit("test.txt");
+    int iterations = argc > 2 ? atoi(argv[2]) : 50000;
+    checkEdits(iterations);
+    checkLoader(argv[1]);
+    checkBudget(argv[1], iterations / 10);
+    E.membudget = 1;
+    checkLoader(argv[1]);
+    return 0;
+}
@@ -0,0 +1,310 @@
+/* Whichever way editorSave() writes the file, what ends up on disk must be
+ * exactly the rows, every one followed by a newline: the same bytes as
+ * editorRowsToString(). The file is checked after every save, with rows
+ * coming from the file mapping, from the add buffer and edited in place,
+ * and while rows are edited during the save. Then all of it again in
+ * memory budget mode, where the save writes the lines of the rows dropped
+ * straight from the mapping.
+ *
+ * Usage: test_save <dir> */
+#include "test.h"
+
+#include <dirent.h>
+
+static char *dir, path[4096], linkpath[4096];
+
+/* Save and wait for the save to complete. */
+static void save(void)
+{
+    editorRowsEvict();
+    CHECK(editorSave() == 0);
+    editorSaveWait();
+    CHECK(strncmp(E.statusmsg, "Can't", 5) != 0);
+    CHECK(E.dirtyrow == -1);
+}
+
+/* Return the content of the file 'name', of '*len' bytes. */
+static char *readFile(char *name, size_t *len)
+{
+    struct stat st;
+    int fd = open(name, O_RDONLY);
+
+    CHECK(fd != -1 && fstat(fd, &st) == 0);
+    char *buf = malloc(st.st_size + 1);
+    CHECK(buf != NULL);
+    CHECK(read(fd, buf, st.st_size) == st.st_size);
+    close(fd);
+    *len = st.st_size;
+    return buf;
+}
+
+/* Compare the file on disk with the rows. */
+static void checkDisk(const char *what)
+{
+    size_t len, want;
+    char *buf = readFile(path, &len);
+    char *rows = editorRowsToString(&want);
+
+    if (len != want || memcmp(buf, rows, len))
+    {
+        fprintf(stderr, "%s: %zu bytes on disk, %zu expected\n", what, len,
+                want);
+        exit(1);
+    }
+    free(buf);
+    free(rows);
+}
+
+/* Write 'n' rows of the form "row <j>" to the file, and open it. */
+static void openRows(int n)
+{
+    FILE *fp = fopen(path, "w");
+
+    CHECK(fp != NULL);
+    for (int j = 0; j < n; j++)
+        fprintf(fp, "row %d\n", j);
+    fclose(fp);
+    CHECK(editorOpen(path) == 0);
+    while (editorLoadProgress() != -1)
+        editorLoadPoll();
+}
+
+/* A new file, and rows streamed in many writev(2) batches, straight from
+ * the mapping and from edited rows alike. */
+static void checkStreaming(void)
+{
+    unlink(path);
+    CHECK(editorOpen(path) == 1);
+    save();
+    checkDisk("empty file");
+    editorInsertRow(0, "", 0);
+    editorInsertRow(1, "", 0);
+    save();
+    checkDisk("empty rows");
+    editorCloseFile();
+
+    openRows(KILO_SAVE_IOV * 3);
+    CHECK(E.map != NULL);
+    for (int j = 0; j < E.numrows; j += 7)
+    {
+        erow *row = editorRowAt(j);
+        editorRowInsertChar(row, row->size / 2, 'x');
+    }
+    editorInsertRow(10, "inserted", 8);
+    editorDelRow(20);
+    save();
+    checkDisk("streamed rows");
+    editorCloseFile();
+}
+
+/* Return true if a temporary file of an atomic save was left behind. */
+static int tempLeft(void)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    int found = 0;
+
+    CHECK(d != NULL);
+    while ((de = readdir(d)) != NULL)
+        found |= strncmp(de->d_name, ".kilo-test-save.txt.kilo", 24) == 0;
+    closedir(d);
+    return found;
+}
+
+/* An existing file is replaced by a new one, with the same permissions. */
+static void checkAtomic(void)
+{
+    struct stat before, after;
+
+    openRows(1000);
+    CHECK(chmod(path, 0640) == 0);
+    CHECK(stat(path, &before) == 0);
+    editorRowInsertChar(editorRowAt(0), 0, 'x');
+    save();
+    checkDisk("atomic save");
+    CHECK(stat(path, &after) == 0);
+    CHECK(after.st_ino != before.st_ino);
+    CHECK((after.st_mode & 07777) == 0640);
+    CHECK(!tempLeft());
+    editorCloseFile();
+}
+
+/* A file with another name is rewritten in place, over the mapping the
+ * rows come from: the rows after an edit move, one way and the other. */
+static void checkInPlace(void)
+{
+    struct stat before, after;
+    size_t len, want;
+
+    openRows(5000);
+    unlink(linkpath);
+    CHECK(link(path, linkpath) == 0);
+    CHECK(stat(path, &before) == 0);
+    editorRowAppendString(editorRowAt(1), "grown", 5);
+    save();
+    checkDisk("in place, rows moved forward");
+    editorRowTruncate(editorRowAt(0), 0);
+    editorDelRow(2);
+    save();
+    checkDisk("in place, rows moved back");
+    CHECK(stat(path, &after) == 0);
+    CHECK(after.st_ino == before.st_ino);
+    CHECK(!tempLeft());
+
+    char *buf = readFile(linkpath, &len);
+    char *rows = editorRowsToString(&want);
+    CHECK(len == want && memcmp(buf, rows, len) == 0);
+    free(buf);
+    free(rows);
+    unlink(linkpath);
+    editorCloseFile();
+}
+
+/* Return the inode of the file. */
+static ino_t inode(void)
+{
+    struct stat st;
+
+    CHECK(stat(path, &st) == 0);
+    return st.st_ino;
+}
+
+/* Past KILO_SAVE_INCREMENTAL_MIN unchanged bytes only the rows from the
+ * first edited one are rewritten, in place, and the file is truncated or
+ * extended to its new length, unless it changed on disk meanwhile or more
+ * than KILO_SAVE_INCREMENTAL_MAX bytes would be. */
+static void checkIncremental(void)
+{
+    openRows(KILO_SAVE_INCREMENTAL_MIN / 8);
+    ino_t ino = inode();
+
+    editorInsertRow(E.numrows, "appended", 8);
+    save();
+    checkDisk("incremental append");
+    CHECK(inode() == ino);
+
+    for (int j = 0; j < 100; j++)
+        editorDelRow(E.numrows - 1);
+    editorRowInsertChar(editorRowAt(E.numrows - 1), 0, 'x');
+    save();
+    checkDisk("incremental truncate");
+    CHECK(inode() == ino);
+
+    /* Someone else wrote to the file: the whole of it is saved again. */
+    FILE *fp = fopen(path, "a");
+    CHECK(fp != NULL);
+    fputs("from elsewhere\n", fp);
+    fclose(fp);
+    editorInsertRow(E.numrows, "appended", 8);
+    save();
+    checkDisk("changed on disk");
+    CHECK(inode() != ino);
+
+    /* An edit at the start rewrites everything. */
+    ino = inode();
+    editorRowInsertChar(editorRowAt(0), 0, 'x');
+    save();
+    checkDisk("edit at the start");
+    CHECK(inode() != ino);
+    editorCloseFile();
+
+    /* So does an edit with too many rows after it. */
+    openRows((KILO_SAVE_INCREMENTAL_MIN + KILO_SAVE_INCREMENTAL_MAX) / 8);
+    ino = inode();
+    editorRowInsertChar(editorRowAt(KILO_SAVE_INCREMENTAL_MIN / 8), 0, 'x');
+    save();
+    checkDisk("edit before a long tail");
+    CHECK(inode() != ino);
+    editorCloseFile();
+}
+
+static char *walked;
+static size_t walkedlen;
+
+/* Append 'row' and a newline to 'walked', or the mapped 'lines'. */
+static int walkRow(erow *row, struct iovec *lines, void *arg)
+{
+    struct iovec span[2];
+    int n = row ? editorRowSpans(row, span) : 0;
+
+    (void)arg;
+    if (lines)
+    {
+        memcpy(walked + walkedlen, lines->iov_base, lines->iov_len);
+        walkedlen += lines->iov_len;
+        return 0;
+    }
+    for (int j = 0; j < n; j++)
+    {
+        memcpy(walked + walkedlen, span[j].iov_base, span[j].iov_len);
+        walkedlen += span[j].iov_len;
+    }
+    walked[walkedlen++] = '\n';
+    return 0;
+}
+
+/* Rows edited, inserted and deleted while a save runs, all over the file
+ * and enough to split and merge leaves and nodes, must not change what the
+ * save writes: the rows as they were when it started. The tree the save
+ * reads is checked too before it completes, whether it is done writing or
+ * not. */
+static void checkEditWhileSaving(void)
+{
+    size_t len, want;
+
+    openRows(KILO_TREE_LEAF * KILO_TREE_FANOUT * 4);
+    editorRowInsertChar(editorRowAt(0), 0, 'x');
+    char *rows = editorRowsToString(&want);
+    struct rowNode *root = E.rows;
+    editorRowsEvict();
+    CHECK(editorSave() == 0);
+    for (int j = 0; j < E.numrows; j += 3)
+    {
+        erow *row = editorRowAt(j);
+        editorRowInsertChar(row, 1, 'y');
+        editorRowChars(row);
+        editorRowDelChar(editorRowAt(j / 2), 0);
+        editorRowAppendString(editorRowAt(j + 1), "appended", 8);
+        editorInsertRow(j, "inserted", 8);
+        if (j % 2)
+            editorDelRow(j / 3);
+    }
+    for (int j = 0; j < KILO_TREE_LEAF * KILO_TREE_FANOUT; j++)
+        editorDelRow(E.numrows / 2);
+    walked = malloc(want);
+    walkedlen = 0;
+    CHECK(editorRowTreeWalk(root, 0, walkRow, NULL) == 0);
+    CHECK(walkedlen == want && memcmp(walked, rows, want) == 0);
+    free(walked);
+    editorSaveWait();
+    CHECK(strncmp(E.statusmsg, "Can't", 5) != 0);
+    char *buf = readFile(path, &len);
+    CHECK(len == want && memcmp(buf, rows, len) == 0);
+    CHECK(E.dirty > 0);
+    free(buf);
+    free(rows);
+
+    save();
+    checkDisk("edits made while saving");
+    editorCloseFile();
+}
+
+int main(int argc, char **argv)
+{
+    CHECK(argc >= 2);
+    dir = argv[1];
+    snprintf(path, sizeof(path), "%s/kilo-test-save.txt", dir);
+    snprintf(linkpath, sizeof(linkpath), "%s/kilo-test-save.link", dir);
+    testInit(path);
+    for (int budget = 0; budget < 2; budget++)
+    {
+        E.membudget = budget ? 4096 : 0;
+        checkStreaming();
+        checkAtomic();
+        checkInPlace();
+        checkIncremental();
+        checkEditWhileSaving();
+    }
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,132 @@
+/* The highlighter must give every character the same HL_* type the rules
+ * kilo always had do. Checked against a golden file, golden.c.hl, holding
+ * the expected types of golden.c one row per line, one digit per rendered
+ * character, and against testReferenceHl() on random rows. The golden file
+ * was written by kilo before the state machine, except for a // comment
+ * after a tab: that used to stop short of the end of the row, as many
+ * characters as the tabs added, which was fixed earlier on.
+ *
+ * Usage: test_syntax <golden.c> <golden.c.hl> [random rows] */
+#include "test.h"
+
+static int failures = 0;
+
+/* Compare the highlight of 'row', the row at 'at', with 'want'. */
+static void checkRow(erow *row, int at, unsigned char *want, const char *what)
+{
+    unsigned char *got = malloc(row->rsize + 1);
+    long long i;
+
+    testRowHl(row, got);
+    for (i = 0; i < row->rsize && got[i] == want[i]; i++);
+    if (i < row->rsize && failures++ < 10)
+    {
+        fprintf(stderr, "%s: row %d differs at column %lld: \"%.*s\"\n",
+                what, at, i, (int)row->rsize, row->render);
+        fprintf(stderr, "  got:  ");
+        for (i = 0; i < row->rsize; i++)
+            fputc('0' + got[i], stderr);
+        fprintf(stderr, "\n  want: ");
+        for (i = 0; i < row->rsize; i++)
+            fputc('0' + want[i], stderr);
+        fputc('\n', stderr);
+    }
+    free(got);
+}
+
+/* Highlight every row of the file, in order, and compare with both the
+ * golden types and the reference rules. */
+static void checkGolden(char *input, char *golden)
+{
+    FILE *in = fopen(input, "r"), *gold = fopen(golden, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int at, ic = 0;
+
+    CHECK(in != NULL && gold != NULL);
+    while ((len = getline(&line, &cap, in)) != -1)
+    {
+        if (len && line[len - 1] == '\n')
+            len--;
+        editorInsertRow(E.numrows, line, len);
+    }
+    at = 0;
+    for (erow *row = editorRowAt(0); row; row = editorRowNext(row), at++)
+    {
+        editorRowMaterialize(row, at);
+        len = getline(&line, &cap, gold);
+        CHECK(len != -1);
+        if (len && line[len - 1] == '\n')
+            len--;
+        CHECK(len == row->rsize);
+        for (ssize_t j = 0; j < len; j++)
+            line[j] -= '0';
+        checkRow(row, at, (unsigned char *)line, "golden");
+
+        unsigned char *ref = malloc(row->rsize + 1);
+        ic = testReferenceHl(row->render, row->rsize, ic, ref);
+        checkRow(row, at, ref, "reference");
+        CHECK(row->hl_oc == ic);
+        free(ref);
+    }
+    CHECK(getline(&line, &cap, gold) == -1);
+    free(line);
+    fclose(in);
+    fclose(gold);
+    while (E.numrows)
+        editorDelRow(E.numrows - 1);
+}
+
+/* Rows made of pieces that meet every rule, compared with the reference
+ * rules. Comments open and close across rows, so the rows are highlighted
+ * in order, each one after the state the row before it ends with. */
+static void checkRandom(int rows)
+{
+    static char *pieces[] = {
+        "/*", "*/", "//", "/", "*", "\"", "'", "\\", " ", "\t", "\x01",
+        "\x7f", "0", "12", ".", "1.5", "x", "_", "a1", "int", "int|", "auto",
+        "const", "const_cast", "if", "iff", "NULL", "nullptr", "xor_eq",
+        "(", ")", ";", ",", "+", "-", "=", "~", "%", "[", "]", "{", "}",
+        "#", "|", "<", ">"};
+    int npieces = sizeof(pieces) / sizeof(pieces[0]);
+    char buf[256];
+    int ic = 0;
+
+    srand(1);
+    for (int j = 0; j < rows; j++)
+    {
+        int len = 0, n = rand() % 12;
+        for (int k = 0; k < n; k++)
+        {
+            char *s = pieces[rand() % npieces];
+            memcpy(buf + len, s, strlen(s));
+            len += strlen(s);
+        }
+        editorInsertRow(E.numrows, buf, len);
+    }
+    int at = 0;
+    for (erow *row = editorRowAt(0); row; row = editorRowNext(row), at++)
+    {
+        editorRowMaterialize(row, at);
+        unsigned char *ref = malloc(row->rsize + 1);
+        ic = testReferenceHl(row->render, row->rsize, ic, ref);
+        checkRow(row, at, ref, "random");
+        CHECK(row->hl_oc == ic);
+        free(ref);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    CHECK(argc >= 3);
+    testInit("golden.c");
+    checkGolden(argv[1], argv[2]);
+    checkRandom(argc > 3 ? atoi(argv[3]) : 100000);
+    if (failures)
+    {
+        fprintf(stderr, "%d rows differ\n", failures);
+        return 1;
+    }
+    return 0;
+}